@@ -0,0 +1,132 @@
+#ifndef BATCHEDWRITER_H
+#define BATCHEDWRITER_H
+
+#ifdef __linux__
+
+#include "IoRing.hpp"
+#include "utils.hpp"
+
+#include <climits>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// Writes outputs with io_uring in batches, the same way as `write_file` (through a temporary file that is renamed
+// into place): workers queue what they generated and go on, and whoever fills a batch creates all of its files
+// with one syscall, writes them with another, and closes and renames them with a third, while the other workers
+// keep parsing. Whatever fails in a batch is written the usual way
+class BatchedWriter {
+public:
+    BatchedWriter() : ring(2 * BATCH) {}
+
+    ~BatchedWriter() {
+        flush();
+    }
+
+    BatchedWriter(const BatchedWriter&) = delete;
+    BatchedWriter& operator=(const BatchedWriter&) = delete;
+
+    // False when io_uring isn't available, then nothing should be queued
+    [[nodiscard]] bool active() const {
+        return ring.valid();
+    }
+
+    // `write_file`, now or with a later batch. Returns whether the file is going to be written
+    bool write(const std::string& path, std::string content) {
+        if (has_content(path, content)) {
+            return false;
+        }
+        std::vector<Output> batch;
+        {
+            std::lock_guard lock(mutex);
+            pending.push_back({ path, temp_path(path), std::move(content) });
+            if (pending.size() < BATCH) return true;
+            batch.swap(pending);
+        }
+        write(batch);
+        return true;
+    }
+
+    // Writes everything queued so far
+    void flush() {
+        std::vector<Output> batch;
+        {
+            std::lock_guard lock(mutex);
+            batch.swap(pending);
+        }
+        if (!batch.empty()) write(batch);
+    }
+
+private:
+    struct Output {
+        std::string path;
+        std::string tmp;
+        std::string content;
+    };
+
+    // the ring has room for two operations of each file in a batch
+    static constexpr unsigned BATCH = 64;
+
+    IoRing ring;
+    std::mutex ring_mutex;
+    std::mutex mutex;
+    std::vector<Output> pending;
+
+    void write(std::vector<Output>& batch) {
+        std::vector<int> fds(batch.size(), -1);
+        std::vector<int> written(batch.size(), -1);
+        std::vector<int> renamed(batch.size(), -1);
+        {
+            std::lock_guard lock(ring_mutex);
+            auto complete = [&](unsigned count, std::vector<int>& out) {
+                if (!ring.submit(count)) return;
+                while (auto completion = ring.reap()) {
+                    out[completion->first] = completion->second;
+                }
+            };
+
+            unsigned creates = 0;
+            for (size_t i = 0; i < batch.size(); i++) {
+                if (batch[i].content.size() <= INT_MAX && ring.create(batch[i].tmp.c_str(), i)) creates++;
+            }
+            complete(creates, fds);
+
+            unsigned writes = 0;
+            for (size_t i = 0; i < batch.size(); i++) {
+                if (fds[i] < 0) continue;
+                const auto& content = batch[i].content;
+                if (ring.write(fds[i], content.data(), static_cast<unsigned>(content.size()), i)) writes++;
+            }
+            complete(writes, written);
+
+            // closes go with the renames, tagged after them so that their results are told apart
+            unsigned last = 0;
+            for (size_t i = 0; i < batch.size(); i++) {
+                if (fds[i] < 0) continue;
+                if (ring.close(fds[i], batch.size() + i)) last++;
+                if (written[i] == static_cast<int>(batch[i].content.size()) && ring.rename(batch[i].tmp.c_str(), batch[i].path.c_str(), i)) last++;
+            }
+            std::vector<int> results(2 * batch.size(), -1);
+            complete(last, results);
+            for (size_t i = 0; i < batch.size(); i++) renamed[i] = results[i];
+        }
+
+        for (size_t i = 0; i < batch.size(); i++) {
+            auto& output = batch[i];
+            if (renamed[i] == 0) continue;
+            std::error_code ec;
+            if (renamed[i] == -EINVAL && written[i] == static_cast<int>(output.content.size())) {
+                // renameat through io_uring needs Linux 5.11
+                std::filesystem::rename(output.tmp, output.path, ec);
+                if (!ec) continue;
+            }
+            std::filesystem::remove(output.tmp, ec);
+            write_file(output.path, output.content);
+        }
+    }
+};
+
+#endif
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "Hash.hpp"
+#include "utils.hpp"
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Content-addressed store of generated `.hpp`/`.cpp` pairs, that can be shared between checkouts.
+// Entries live in `<dir>/<first 2 hex digits>/<key>.hpp|.cpp`, recently used ones have newer mtime
+class GenerationCache {
+public:
+    GenerationCache(std::filesystem::path dir, uint64_t max_size) : dir(std::move(dir)), max_size(max_size) {}
+
+    // `meta` should hold everything besides the code that affects the outputs
+    static uint64_t key(std::string_view code, const std::string& meta) {
+        return hash64(code, hash64(meta));
+    }
+
+    // Puts the cached outputs for `key` to `h_file` and `c_file`, if there are any
+    bool restore(uint64_t key, const std::string& h_file, const std::string& c_file) {
+        auto [h, c] = entry(key);
+        std::error_code ec;
+        if (!std::filesystem::exists(h, ec) || !std::filesystem::exists(c, ec)) {
+            return false;
+        }
+        // new mtime marks the entry as recently used; outputs are never the same inode as the entry, so no checkout sees it
+        auto now = std::filesystem::file_time_type::clock::now();
+        std::filesystem::last_write_time(h, now, ec);
+        std::filesystem::last_write_time(c, now, ec);
+        return materialize(h, h_file) && materialize(c, c_file);
+    }
+
+    void store(uint64_t key, const std::string& h_code, const std::string& c_code) {
+        auto [h, c] = entry(key);
+        std::error_code ec;
+        std::filesystem::create_directories(std::filesystem::path(h).parent_path(), ec);
+        // `.hpp` goes last, so an entry is complete once it's there
+        try {
+            write_file(c, c_code);
+            write_file(h, h_code);
+        } catch (const std::filesystem::filesystem_error&) {
+            // not being able to store is just a future cache miss
+        }
+    }
+
+    // Removes least recently used entries until the cache fits `max_size` bytes
+    void evict() {
+        if (max_size == 0) return;
+
+        struct File {
+            std::filesystem::file_time_type time;
+            uintmax_t size;
+            std::filesystem::path path;
+        };
+        std::vector<File> files;
+        uintmax_t total = 0;
+        std::error_code ec;
+        for (auto it = std::filesystem::recursive_directory_iterator(dir, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+            if (!it->is_regular_file(ec)) continue;
+            // someone else is writing it right now
+            if (it->path().filename().string().find(".tmp-") != std::string::npos) continue;
+            auto size = it->file_size(ec);
+            files.push_back({ it->last_write_time(ec), size, it->path() });
+            total += size;
+        }
+        if (total <= max_size) return;
+
+        std::sort(files.begin(), files.end(), [](const File& a, const File& b) {
+            return a.time < b.time;
+        });
+        for (const auto& file : files) {
+            if (total <= max_size) break;
+            if (std::filesystem::remove(file.path, ec)) {
+                total -= file.size;
+            }
+        }
+    }
+
+private:
+    std::filesystem::path dir;
+    uint64_t max_size;
+
+    [[nodiscard]] std::pair<std::string, std::string> entry(uint64_t key) const {
+        auto name = to_hex(key);
+        auto base = dir / name.substr(0, 2) / name;
+        return { base.string() + ".hpp", base.string() + ".cpp" };
+    }
+
+    // Reflink, otherwise a copy in the kernel, otherwise copy; always renamed into place. Not a hardlink:
+    // the entry would then be the output of every checkout that restored it, and so would its mtime
+    static bool materialize(const std::string& from, const std::string& to) {
+        if (same_content(from, to)) {
+            return true;
+        }
+        auto tmp = temp_path(to);
+        if (!reflink_file(from, tmp) && !copy_range_file(from, tmp)) {
+            std::error_code ec;
+            std::filesystem::copy_file(from, tmp, std::filesystem::copy_options::overwrite_existing, ec);
+            if (ec) return false;
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp, to, ec);
+        if (ec) {
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+        return true;
+    }
+};
+
+#endif
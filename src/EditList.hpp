@@ -0,0 +1,99 @@
+#ifndef EDITLIST_H
+#define EDITLIST_H
+
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Replacements of an `Extraction`, sorted by position and checked against the code they are applied to.
+// Applies them in one pass and maps offsets between the original and the modified code with binary searches
+class EditList {
+public:
+    struct Edit {
+        long start, end;            // replaced range of the original
+        long modifiedStart;         // where the new text is in the modified code
+        long modifiedEnd;
+        long deltaBefore;           // size change by all edits before this one
+        const std::string* text;
+    };
+
+    EditList(const std::vector<std::pair<std::pair<long, long>, std::string>>& replacements, long codeSize) {
+        edits.reserve(replacements.size());
+        for (const auto &[range, text] : replacements) {
+            edits.push_back({ range.first, range.second, 0, 0, 0, &text });
+        }
+        // visitors add edits in traversal order, insertions at the same offset keep theirs
+        std::stable_sort(edits.begin(), edits.end(), [](const Edit& a, const Edit& b) {
+            return a.start < b.start;
+        });
+
+        long lastEnd = 0, delta = 0;
+        size_t kept = 0;
+        for (auto edit : edits) {
+            // an edit inside an already replaced range has nothing left to replace
+            if (edit.start < lastEnd && edit.end <= lastEnd) continue;
+            // anything else that doesn't fit is a bad replacement from a visitor, the output would be wrong either way
+            bool fits = edit.start >= lastEnd && edit.start <= edit.end && edit.end <= codeSize;
+            assert(fits && "replacement overlaps an earlier one or is out of the code");
+            if (!fits) continue;
+            edit.modifiedStart = edit.start + delta;
+            edit.modifiedEnd = edit.modifiedStart + static_cast<long>(edit.text->size());
+            edit.deltaBefore = delta;
+            delta += static_cast<long>(edit.text->size()) - (edit.end - edit.start);
+            lastEnd = edit.end;
+            edits[kept++] = edit;
+        }
+        edits.resize(kept);
+        totalDelta = delta;
+    }
+
+    [[nodiscard]] std::string apply(std::string_view code) const {
+        std::string result;
+        result.reserve(code.size() + totalDelta);
+        long index = 0;
+        for (const auto& edit : edits) {
+            result.append(code.substr(index, edit.start - index));
+            result += *edit.text;
+            index = edit.end;
+        }
+        result.append(code.substr(index));
+        return result;
+    }
+
+    // Offset in the original code for `modifiedOffset`; inside a new text, the start of the range it replaced
+    [[nodiscard]] long originalOffset(long modifiedOffset) const {
+        auto it = std::upper_bound(edits.begin(), edits.end(), modifiedOffset, [](long offset, const Edit& edit) {
+            return offset < edit.modifiedEnd;
+        });
+        if (it == edits.end()) return modifiedOffset - totalDelta;
+        if (it->modifiedStart <= modifiedOffset) return it->start;
+        return modifiedOffset - it->deltaBefore;
+    }
+
+    // Offset in the modified code for `originalOffset`; inside a replaced range, the start of its new text
+    [[nodiscard]] long modifiedOffset(long originalOffset) const {
+        auto it = std::upper_bound(edits.begin(), edits.end(), originalOffset, [](long offset, const Edit& edit) {
+            return offset < edit.end;
+        });
+        if (it == edits.end()) return originalOffset + totalDelta;
+        if (it->start <= originalOffset) return it->modifiedStart;
+        return originalOffset + it->deltaBefore;
+    }
+
+    [[nodiscard]] bool empty() const {
+        return edits.empty();
+    }
+
+    [[nodiscard]] const std::vector<Edit>& sorted() const {
+        return edits;
+    }
+
+private:
+    std::vector<Edit> edits;
+    long totalDelta = 0;
+};
+
+#endif
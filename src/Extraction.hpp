@@ -0,0 +1,133 @@
+#ifndef EXTRACTION_H
+#define EXTRACTION_H
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace headless {
+
+// Piece of generated `.cpp` code. Only `Text` is always rendered, the rest depends on options
+struct Fragment {
+    enum Kind : uint8_t {
+        Text,       // `text` as is
+        LinesText,  // `text`, only when adding #line
+        Line,       // #line for `offset`, only when adding #line
+        Original    // `text` taken from `offset` of the original, split with #line when adding them
+    };
+
+    Kind kind;
+    long offset;
+    std::string text;
+};
+
+// Everything clang found in a header, independent of the output options:
+// edits that turn it into the generated header, and fragments of the generated `.cpp`
+struct Extraction {
+    std::vector<std::pair<std::pair<long, long>, std::string>> replacements;
+    std::vector<Fragment> fragments;
+
+    void text(std::string_view s, Fragment::Kind kind = Fragment::Text) {
+        if (s.empty()) return;
+        if (!fragments.empty() && fragments.back().kind == kind && kind != Fragment::Original) {
+            fragments.back().text += s;
+            return;
+        }
+        fragments.push_back({ kind, 0, std::string(s) });
+    }
+
+    void line(long offset) {
+        fragments.push_back({ Fragment::Line, offset, "" });
+    }
+
+    void original(long offset, std::string_view s) {
+        fragments.push_back({ Fragment::Original, offset, std::string(s) });
+    }
+};
+
+// Binary form of `Extraction`, for keeping it between runs
+
+const char EXTRACTION_MAGIC[4] = { 'H', 'L', 'X', '1' };
+
+inline void put_number(std::string& out, int64_t value) {
+    char bytes[sizeof(value)];
+    std::memcpy(bytes, &value, sizeof(value));
+    out.append(bytes, sizeof(bytes));
+}
+
+inline void put_string(std::string& out, std::string_view value) {
+    put_number(out, static_cast<int64_t>(value.size()));
+    out += value;
+}
+
+inline std::string serializeExtraction(const Extraction& extraction) {
+    size_t size = sizeof(EXTRACTION_MAGIC) + 16;
+    for (const auto &[range, text] : extraction.replacements) size += 24 + text.size();
+    for (const auto& fragment : extraction.fragments) size += 17 + fragment.text.size();
+
+    std::string out;
+    out.reserve(size);
+    out.append(EXTRACTION_MAGIC, sizeof(EXTRACTION_MAGIC));
+    put_number(out, static_cast<int64_t>(extraction.replacements.size()));
+    for (const auto &[range, text] : extraction.replacements) {
+        put_number(out, range.first);
+        put_number(out, range.second);
+        put_string(out, text);
+    }
+    put_number(out, static_cast<int64_t>(extraction.fragments.size()));
+    for (const auto& fragment : extraction.fragments) {
+        out += static_cast<char>(fragment.kind);
+        put_number(out, fragment.offset);
+        put_string(out, fragment.text);
+    }
+    return out;
+}
+
+inline std::optional<Extraction> parseExtraction(std::string_view in) {
+    auto number = [&](int64_t& value) {
+        if (in.size() < sizeof(value)) return false;
+        std::memcpy(&value, in.data(), sizeof(value));
+        in.remove_prefix(sizeof(value));
+        return true;
+    };
+    auto string = [&](std::string& value) {
+        int64_t size;
+        if (!number(size) || size < 0 || static_cast<uint64_t>(size) > in.size()) return false;
+        value = in.substr(0, size);
+        in.remove_prefix(size);
+        return true;
+    };
+
+    if (in.substr(0, sizeof(EXTRACTION_MAGIC)) != std::string_view(EXTRACTION_MAGIC, sizeof(EXTRACTION_MAGIC))) {
+        return std::nullopt;
+    }
+    in.remove_prefix(sizeof(EXTRACTION_MAGIC));
+
+    Extraction extraction;
+    int64_t count;
+    if (!number(count)) return std::nullopt;
+    for (int64_t i = 0; i < count; i++) {
+        int64_t start, end;
+        std::string text;
+        if (!number(start) || !number(end) || !string(text)) return std::nullopt;
+        extraction.replacements.emplace_back(std::pair{ start, end }, std::move(text));
+    }
+    if (!number(count)) return std::nullopt;
+    for (int64_t i = 0; i < count; i++) {
+        if (in.empty() || static_cast<uint8_t>(in[0]) > Fragment::Original) return std::nullopt;
+        auto kind = static_cast<Fragment::Kind>(in[0]);
+        in.remove_prefix(1);
+        int64_t offset;
+        std::string text;
+        if (!number(offset) || !string(text)) return std::nullopt;
+        extraction.fragments.push_back({ kind, static_cast<long>(offset), std::move(text) });
+    }
+    return extraction;
+}
+
+}
+
+#endif
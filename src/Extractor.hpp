@@ -2,58 +2,55 @@
 #define EXTRACTOR_H
 
 #include "IfDefParser.hpp"
+#include "Extraction.hpp"
+#include "LineIndex.hpp"
 #include "utils.hpp"
 
 #include <optional>
+#include <string_view>
 #include <clang/AST/RecursiveASTVisitor.h>
 #include <clang/Frontend/FrontendAction.h>
 #include <clang/Frontend/CompilerInstance.h>
 
-#include <sstream>
+namespace headless {
 
-bool is_whitespace(char a) {
-    return a == ' ' || a == '\t' || a == '\n' || a == '\r' || a == '\f' || a == '\v';
-}
-
-bool isConstQualified(clang::ParmVarDecl *p) {
+inline bool isConstQualified(clang::ParmVarDecl *p) {
     return p->getType().isConstQualified() || p->getType().isLocalConstQualified();
 }
 
 class ImplementationExtractor : public clang::RecursiveASTVisitor<ImplementationExtractor> {
 public:
     explicit ImplementationExtractor(
-        std::shared_ptr<std::vector<std::pair<long, IfRule>>> rules,
-        std::optional<std::string> pathForLines,
+        std::shared_ptr<IfDefIndex> ifdefs,
         clang::SourceManager &SM
     )
-        : SM(SM), pathForLines(pathForLines), rules(rules) {}
+        : SM(SM), ifdefs(ifdefs), lines(bufferOf(SM)) {}
 
     bool VisitFunctionDecl(clang::FunctionDecl *f) {
         if (f->hasBody() && !f->isConstexpr() && !f->isInlineSpecified()) {
             auto bodyRange = f->getBody()->getSourceRange();
-            std::stringstream s;
+            auto& s = extraction;
 
             auto ifdef = getIfdefAt(getStartOffset(f->getBeginLoc()));
             if (ifdef) {
-                s << *ifdef << "\n";
-            }
-            if (pathForLines) {
-                s << "\n#line " << getLineNumber(getStartOffset(f->getBeginLoc())) << " \"" << pathForLines.value() << "\"\n";
+                s.text(*ifdef + "\n");
             }
+            s.line(getStartOffset(f->getBeginLoc()));
             if (auto* funcTemplate = f->getDescribedFunctionTemplate()) {
-                s << originalAt(funcTemplate->getBeginLoc(), funcTemplate->getTemplateParameters()->getRAngleLoc()) << "\n";
+                s.text(originalAt(funcTemplate->getBeginLoc(), funcTemplate->getTemplateParameters()->getRAngleLoc()));
+                s.text("\n");
             }
             if (f->getReturnType().isConstQualified()) {
-                s << "const ";
+                s.text("const ");
             }
-            s << originalAt(f->getReturnTypeSourceRange());
-            s << " ";
-            s << f->getQualifiedNameAsString();
-            s << "(";
+            s.text(originalAt(f->getReturnTypeSourceRange()));
+            s.text(" ");
+            s.text(f->getQualifiedNameAsString());
+            s.text("(");
             bool first = true, addedLines = false;
             for (const auto &p : f->parameters()) {
                 if (!first) {
-                    s << ", ";
+                    s.text(", ");
                 }
                 first = false;
                 auto range = p->getSourceRange();
@@ -62,29 +59,29 @@ public:
                 if (p->hasDefaultArg()) {
                     end = getEndOffset(p->getLocation());
                 }
-                if (pathForLines && getLineNumber(start) != getLineNumber(getStartOffset(f->getBeginLoc()))) {
-                    s << "\n#line " << getLineNumber(start) << " \"" << pathForLines.value() << "\"\n\t";
+                if (getLineNumber(start) != getLineNumber(getStartOffset(f->getBeginLoc()))) {
+                    s.line(start);
+                    s.text("\t", Fragment::LinesText);
                     addedLines = true;
                 }
-                s << originalAt(start, end);
+                s.text(originalAt(start, end));
             }
-            if (addedLines && pathForLines) {
-                s << "\n";
+            if (addedLines) {
+                s.text("\n", Fragment::LinesText);
             }
-            s << ") ";
+            s.text(") ");
             if (f->getFunctionType()->isConst()) {
-                s << "const ";
+                s.text("const ");
             }
-            pushOriginal(s, bodyRange);
-            s << ";\n";
+            s.original(getStartOffset(bodyRange.getBegin()), originalAt(bodyRange));
+            s.text(";\n");
             if (ifdef) {
-                s << "#endif\n";
+                s.text("#endif\n");
             }
 
             long idx = getStartOffset(bodyRange.getBegin()) - 1;
             while (idx >= 0 && is_whitespace(originalAt(idx))) { idx--; }
             replace(idx + 1, getEndOffset(bodyRange.getEnd()), originalAt(getEndOffset(bodyRange.getEnd())) == ';' ? "" : ";");
-            cppCode << s.str();
         }
         return true;
     }
@@ -142,119 +139,38 @@ public:
                     replace(getEndOffset(decl->getLocation()), getEndOffset(initRange.getEnd()), "");
                 }
 
-                std::stringstream s;
+                auto& s = extraction;
                 auto ifdef = getIfdefAt(getStartOffset(decl->getBeginLoc()));
                 if (ifdef) {
-                    s << *ifdef << "\n";
-                }
-                if (pathForLines) {
-                    s << "\n#line " << getLineNumber(getStartOffset(decl->getBeginLoc())) << " \"" << pathForLines.value() << "\"\n";
+                    s.text(*ifdef + "\n");
                 }
+                s.line(getStartOffset(decl->getBeginLoc()));
                 std::string type;
                 if (decl->getType()->getContainedAutoType()) {
                     type = decl->getType().getAsString();
                 } else {
-                    type = originalAt(typeRange);
+                    type = std::string(originalAt(typeRange));
                     auto staticInType = type.find("static ");
                     if (staticInType != std::string::npos) {
                         type.replace(staticInType, 7, "");
                     }
                 }
-                s << type;
-                s << " " << decl->getQualifiedNameAsString();
-                s << " = ";
-                pushOriginal(s, initRange);
-                s << ";\n";
+                s.text(type);
+                s.text(" " + decl->getQualifiedNameAsString());
+                s.text(" = ");
+                s.original(getStartOffset(initRange.getBegin()), originalAt(initRange));
+                s.text(";\n");
                 if (ifdef) {
-                    s << "#endif\n";
+                    s.text("#endif\n");
                 }
-
-                cppCode << s.str();
             }
         }
         return true;
     }
 
-    void pushOriginal(std::stringstream& s, const clang::SourceRange& range) {
-        if (!pathForLines) {
-            s << originalAt(range);
-            return;
-        }
-
-        std::string original = originalAt(range);
-        long startOffset = getStartOffset(range.getBegin());
-        long firstLineNumber = getLineNumber(startOffset);
-        long index = 0;
-        while (index != std::string::npos && index < original.length()) {
-            long nextLineIndex = original.find_first_of('\n', index);
-            long lineEndIndex = nextLineIndex == std::string::npos ? original.length() : nextLineIndex - index;
-            auto line = original.substr(index, lineEndIndex);
-            if (firstLineNumber != getLineNumber(startOffset + index + 1)) {
-                s << "\n#line " << getLineNumber(startOffset + index + 1) << " \"" << pathForLines.value() << "\"\n";
-            }
-            s << line;
-            if (nextLineIndex == std::string::npos) break;
-            index = nextLineIndex + 1;
-        }
-    }
-
-    long getOriginalOffset(long modifiedOffset) {
-        long cumulativeDelta = 0;
-        for (const auto &r : replacements) {
-            long origStart = r.first.first;
-            long origEnd   = r.first.second;
-            long origLength = origEnd - origStart;
-            long newLength  = static_cast<long>(r.second.size());
-            long delta = newLength - origLength;
-            long modStart = origStart + cumulativeDelta;
-            long modEnd = modStart + newLength;
-
-            if (modifiedOffset >= modStart && modifiedOffset < modEnd) {
-                return origStart;
-            }
-            if (modifiedOffset >= modEnd) {
-                cumulativeDelta += delta;
-            } else {
-                break;
-            }
-        }
-        return modifiedOffset - cumulativeDelta;
-    }
-
-    std::string getModifiedHeader(std::string sourceText) {
-        for (long i = replacements.size() - 1; i >= 0; --i) {
-            const auto &[range, newText] = replacements[i];
-            const auto &[start, end] = range;
-            sourceText.replace(start, end - start, newText);
-        }
-
-        if (pathForLines) {
-            std::stringstream s;
-            long lastLineNumber = -1;
-            long index = 0;
-            while (index != std::string::npos && index < sourceText.length()) {
-                long nextLineIndex = sourceText.find_first_of('\n', index);
-                long lineEndIndex = nextLineIndex == std::string::npos ? sourceText.length() : nextLineIndex - index;
-                auto line = sourceText.substr(index, lineEndIndex);
-                long lineNumber = getLineNumber(getOriginalOffset(index + 1));
-                if (lastLineNumber != lineNumber && !(line.empty() || trim(line).empty())) {
-                    if (index > 0) {
-                        s << "\n";
-                    }
-                    s << "#line " << lineNumber << " \"" << pathForLines.value() << "\"\n";
-                }
-                s << line;
-                if (nextLineIndex == std::string::npos) break;
-                index = nextLineIndex + 1;
-            }
-            return s.str();
-        } else {
-            return sourceText;
-        }
-    }
-
-    std::string getCppImplementations() {
-        return cppCode.str();
+    Extraction getExtraction() {
+        extraction.replacements = std::move(replacements);
+        return std::move(extraction);
     }
 
 private:
@@ -262,28 +178,19 @@ private:
     int replaceOffset = 0;
     clang::SourceManager &SM;
     clang::LangOptions langOpts;
-    std::ostringstream cppCode;
-    std::optional<std::string> pathForLines;
-    std::shared_ptr<std::vector<std::pair<long, IfRule>>> rules;
+    Extraction extraction;
+    std::shared_ptr<IfDefIndex> ifdefs;
 
     std::vector<std::pair<std::pair<long, long>, std::string>> replacements;
+    LineIndex lines;
+
+    static std::string_view bufferOf(clang::SourceManager &SM) {
+        auto buffer = SM.getBufferData(SM.getMainFileID());
+        return { buffer.data(), buffer.size() };
+    }
 
     std::optional<std::string> getIfdefAt(const long& x) {
-        std::optional<IfRule> current_rule = std::nullopt;
-        for (const auto &[offset, rule] : *rules) {
-            if (rule.end) {
-                if (offset >= x) {
-                    return current_rule.has_value() ? std::optional{ current_rule.value().toString() } : std::nullopt;
-                }
-            } else {
-                if (offset <= x) {
-                    current_rule = std::optional{ rule };
-                } else {
-                    return current_rule.has_value() ? std::optional{ current_rule.value().toString() } : std::nullopt;
-                }
-            }
-        }
-        return std::nullopt;
+        return ifdefs->at(x);
     }
 
     bool isInsideRecord(const clang::Decl *d) {
@@ -297,19 +204,21 @@ private:
         return false;
     }
 
-    std::string originalAt(const clang::SourceRange& range) {
-        return clang::Lexer::getSourceText(clang::CharSourceRange::getTokenRange(range), SM, langOpts).str();
+    // views into clang's buffer, valid while the visitor runs
+    std::string_view originalAt(const clang::SourceRange& range) {
+        auto text = clang::Lexer::getSourceText(clang::CharSourceRange::getTokenRange(range), SM, langOpts);
+        return { text.data(), text.size() };
     }
 
-    std::string originalAt(long start, long end) {
+    std::string_view originalAt(long start, long end) {
         auto buffer = SM.getBufferData(SM.getMainFileID());
         if (start >= 0 && static_cast<size_t>(start) < buffer.size() && end >= start && static_cast<size_t>(end) < buffer.size()) {
-            return std::string(buffer.substr(start, end - start));
+            return { buffer.data() + start, static_cast<size_t>(end - start) };
         }
         return "";
     }
 
-    std::string originalAt(const clang::SourceLocation& startLoc, const clang::SourceLocation& endLoc) {
+    std::string_view originalAt(const clang::SourceLocation& startLoc, const clang::SourceLocation& endLoc) {
         return originalAt(
             getStartOffset(startLoc),
             getEndOffset(endLoc)
@@ -334,7 +243,7 @@ private:
     }
 
     long getLineNumber(long offset) {
-        return SM.getSpellingLineNumber(SM.getComposedLoc(SM.getMainFileID(), offset));
+        return lines.lineOf(offset);
     }
 
     void replace(const clang::SourceRange& range, const clang::StringRef& newString) {
@@ -346,37 +255,24 @@ private:
     }
 };
 
-struct ExtractionResult {
-    std::string h_code;
-    std::string c_code;
-};
-
 class ExtractAction : public clang::ASTFrontendAction {
 private:
-    std::string originalHeaderCode;
-    std::shared_ptr<ExtractionResult> result;
-    std::shared_ptr<std::vector<std::pair<long, IfRule>>> rules;
-    std::optional<std::string> pathForLines;
+    std::shared_ptr<Extraction> result;
+    std::shared_ptr<IfDefIndex> ifdefs;
 
 public:
 
     ExtractAction(
-        std::string originalHeaderCode,
-        std::shared_ptr<ExtractionResult> r,
-        std::vector<std::pair<long, IfRule>> rules,
-        std::optional<std::string> pathForLines
+        std::shared_ptr<Extraction> r,
+        IfDefIndex ifdefs
     ):
-    originalHeaderCode(std::move(originalHeaderCode)),
     result(std::move(r)),
-    rules(std::make_shared<std::vector<std::pair<long, IfRule>>>(rules)),
-    pathForLines(pathForLines) {}
+    ifdefs(std::make_shared<IfDefIndex>(std::move(ifdefs))) {}
 
     void EndSourceFileAction() override {
-        ImplementationExtractor extractor(rules, pathForLines, getCompilerInstance().getSourceManager());
+        ImplementationExtractor extractor(ifdefs, getCompilerInstance().getSourceManager());
         extractor.TraverseDecl(getCompilerInstance().getASTContext().getTranslationUnitDecl());
-
-        result->h_code = extractor.getModifiedHeader(originalHeaderCode);
-        result->c_code = extractor.getCppImplementations();
+        *result = extractor.getExtraction();
     }
 
     bool BeginSourceFileAction(clang::CompilerInstance &CI) override {
@@ -392,4 +288,6 @@ public:
     }
 };
 
+}
+
 #endif
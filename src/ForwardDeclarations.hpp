@@ -0,0 +1,522 @@
+#ifndef FORWARDDECLARATIONS_H
+#define FORWARDDECLARATIONS_H
+
+#include "headless.hpp"
+#include "EditList.hpp"
+#include "Extraction.hpp"
+#include "IfDefParser.hpp"
+#include "IncludePruner.hpp"
+#include "LexerExtractor.hpp"
+
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace headless {
+
+// Identifiers in #define lines of `cleared` (code after `parseIfDefs`), which `tokenize` skips
+inline std::set<std::string_view> namesInMacros(std::string_view cleared) {
+    std::set<std::string_view> names;
+    for (size_t start = 0; start < cleared.size();) {
+        auto end = cleared.find('\n', start);
+        while (end != std::string_view::npos && end > 0 && cleared[end - 1] == '\\') end = cleared.find('\n', end + 1);
+        if (end == std::string_view::npos) end = cleared.size();
+        auto line = cleared.substr(start, end - start);
+        auto i = line.find_first_not_of(" \t");
+        if (i != std::string_view::npos && line[i] == '#') {
+            i = line.find_first_not_of(" \t", i + 1);
+            if (i != std::string_view::npos && line.substr(i, 6) == "define") {
+                for (i += 6; i < line.size(); i++) {
+                    if (!isIdentifierChar(line[i]) || std::isdigit(static_cast<unsigned char>(line[i]))) continue;
+                    auto nameEnd = i;
+                    while (nameEnd < line.size() && isIdentifierChar(line[nameEnd])) nameEnd++;
+                    names.insert(line.substr(i, nameEnd - i));
+                    i = nameEnd;
+                }
+            }
+        }
+        start = end + 1;
+    }
+    return names;
+}
+
+inline bool isNameToken(const Token& token) {
+    return token.kind == Token::Identifier;
+}
+
+// Index right after the `>` matching the `<` at `i`, stops at `;` and braces when there is none
+inline size_t skipAngles(const std::vector<Token>& tokens, size_t i) {
+    int depth = 0;
+    for (; i < tokens.size(); i++) {
+        auto text = tokens[i].text;
+        if (text == "<") {
+            depth++;
+        } else if (text == ">" || text == ">>") {
+            depth -= static_cast<int>(text.size());
+            if (depth <= 0) return i + 1;
+        } else if (text == ";" || text == "{" || text == "}") {
+            return i;
+        }
+    }
+    return i;
+}
+
+// A class that a header defines, and another header can declare instead of including it
+struct ClassDeclaration {
+    std::string name;
+    std::string declaration;    // `namespace a { template <typename T> class Name; }`
+};
+
+// What a project header declares, as far as replacing includes of it with forward declarations goes
+struct HeaderDeclarations {
+    // classes at namespace scope and outside #if blocks; templates only without default arguments,
+    // which can't be given again, and only with parameters that don't depend on anything
+    std::vector<ClassDeclaration> classes;
+    // everything else at namespace scope: other classes, enums, aliases, functions, variables
+    std::set<std::string, std::less<>> names;
+    std::vector<IncludeDirective> includes;
+    // defines macros (other than its guard) or has `using namespace`, so including it can change what code after it means
+    bool opaque = false;
+};
+
+inline HeaderDeclarations headerDeclarations(std::string_view code) {
+    auto [ifdefs, cleared] = parseIfDefs(code);
+    HeaderDeclarations result;
+    result.includes = includeDirectives(ifdefs, cleared);
+    auto guard = includeGuard(ifdefs, cleared);
+
+    std::set<std::string> macros;
+    auto tokens = tokenize(cleared, macros);
+    for (const auto& macro : macros) {
+        if (guard != "#if !defined(" + macro + ")") result.opaque = true;
+    }
+    auto is = [&](size_t k, std::string_view text) { return k < tokens.size() && tokens[k].text == text; };
+    auto isName = [&](size_t k) { return k < tokens.size() && isNameToken(tokens[k]); };
+    auto add = [&](size_t k) {
+        static const std::set<std::string_view> keywords = {
+            "operator", "const", "noexcept", "override", "final", "default", "delete", "throw", "static_assert", "enum"
+        };
+        if (isName(k) && !keywords.contains(tokens[k].text)) result.names.emplace(tokens[k].text);
+    };
+
+    // names declared by variables and functions in `[from, to)`; initializers and parameters are skipped
+    auto addDeclared = [&](size_t from, size_t to) {
+        if (is(from, "template")) from = skipAngles(tokens, from + 1);
+        int depth = 0;
+        for (size_t k = from; k < to; k++) {
+            auto text = tokens[k].text;
+            if (text == "(" || text == "[" || text == "<") depth++;
+            if (text == ")" || text == "]" || text == ">") depth--;
+            if (depth != 0) continue;
+            if (text == "=") {
+                for (int nested = 0; k + 1 < to && (nested > 0 || !is(k + 1, ",")); k++) {
+                    if (is(k + 1, "(") || is(k + 1, "[")) nested++;
+                    if (is(k + 1, ")") || is(k + 1, "]")) nested--;
+                }
+                continue;
+            }
+            if (k + 1 == to || is(k + 1, "(") || is(k + 1, ",") || is(k + 1, "=") || is(k + 1, "[") || is(k + 1, ";")) add(k);
+        }
+    };
+
+    // a template head that can be repeated as it is: only parameters, no defaults and nothing from other headers
+    auto plainTemplate = [&](size_t from, size_t to) {
+        static const std::set<std::string_view> allowed = {
+            "template", "typename", "class", "int", "unsigned", "long", "short", "char", "bool", "size_t", "std", "auto"
+        };
+        for (size_t k = from; k < to; k++) {
+            if (is(k, "=")) return false;
+            if (isName(k) && !allowed.contains(tokens[k].text) && !is(k + 1, ",") && !is(k + 1, ">")) return false;
+        }
+        return true;
+    };
+
+    struct Scope {
+        bool isNamespace;
+        bool declarable;            // a named namespace, classes in it can be declared from outside
+        std::string open, close;
+    };
+    std::vector<Scope> scopes;
+    auto atNamespaceScope = [&]() {
+        return std::all_of(scopes.begin(), scopes.end(), [](const Scope& scope) { return scope.isNamespace; });
+    };
+
+    size_t statement = 0;
+    for (size_t i = 0; i < tokens.size(); i++) {
+        auto text = tokens[i].text;
+        if (text == "}") {
+            if (!scopes.empty()) scopes.pop_back();
+            statement = i + 1;
+            continue;
+        }
+        if (text != "{" && text != ";") continue;
+        if (!atNamespaceScope() || statement == i) {
+            if (text == "{") scopes.push_back({ false, false, "", "" });
+            statement = i + 1;
+            continue;
+        }
+
+        size_t k = statement;
+        if (text == "{") {
+            if (is(k, "inline")) k++;
+            if (is(k, "namespace")) {
+                Scope scope = { true, true, "", "" };
+                bool isInline = is(statement, "inline");
+                for (k++; k < i && isName(k); k += is(k + 1, "::") ? 2 : 1) {
+                    scope.open.append(isInline ? "inline namespace " : "namespace ").append(tokens[k].text).append(" { ");
+                    scope.close += " }";
+                    isInline = false;
+                }
+                // names in an anonymous namespace are still seen by includers, but they are not the same class anywhere else
+                if (scope.open.empty()) scope.declarable = false;
+                scopes.push_back(std::move(scope));
+            } else if (is(statement, "extern") && i == statement + 1) {
+                // `extern "C" {`
+                scopes.push_back({ true, true, "", "" });
+            } else {
+                k = statement;
+                size_t templateEnd = k;
+                if (is(k, "template")) {
+                    templateEnd = skipAngles(tokens, k + 1);
+                    k = templateEnd;
+                }
+                if (is(k, "class") || is(k, "struct") || is(k, "union")) {
+                    size_t end = k + 1;
+                    while (end < i && !is(end, ":")) end++;
+                    size_t name = end - 1;
+                    if (is(name, "final")) name--;
+                    if (name > k && isName(name) && !is(name - 1, "::")) {
+                        auto condition = ifdefs.at(tokens[k].start);
+                        bool unconditional = !condition || condition == guard;
+                        bool declarable = std::all_of(scopes.begin(), scopes.end(), [](const Scope& scope) { return scope.declarable; });
+                        if (declarable && unconditional && plainTemplate(statement, templateEnd)) {
+                            std::string declaration;
+                            for (const auto& scope : scopes) declaration += scope.open;
+                            if (templateEnd > statement) {
+                                auto head = std::string_view(cleared).substr(tokens[statement].start, tokens[templateEnd - 1].end() - tokens[statement].start);
+                                bool space = false;
+                                for (char c : head) {
+                                    if (is_whitespace(c)) {
+                                        space = true;
+                                        continue;
+                                    }
+                                    if (space) declaration += ' ';
+                                    declaration += c;
+                                    space = false;
+                                }
+                                declaration += ' ';
+                            }
+                            declaration.append(tokens[k].text).append(" ").append(tokens[name].text).append(";");
+                            for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) declaration += scope->close;
+                            result.classes.push_back({ std::string(tokens[name].text), std::move(declaration) });
+                        } else {
+                            add(name);
+                        }
+                    }
+                } else if (is(k, "enum")) {
+                    size_t end = k + 1;
+                    while (end < i && !is(end, ":")) end++;
+                    add(end - 1);
+                    // enumerators of unscoped enums are names of the namespace
+                    if (!is(k + 1, "class") && !is(k + 1, "struct")) {
+                        int depth = 0;
+                        for (size_t e = i + 1; e < tokens.size() && !(depth == 0 && is(e, "}")); e++) {
+                            if (is(e, "(") || is(e, "{")) depth++;
+                            if (is(e, ")") || is(e, "}")) depth--;
+                            if (depth == 0 && (is(e - 1, "{") || is(e - 1, ","))) add(e);
+                        }
+                    }
+                } else {
+                    addDeclared(statement, i);
+                }
+                scopes.push_back({ false, false, "", "" });
+            }
+            statement = i + 1;
+            continue;
+        }
+
+        // `;` at namespace scope
+        if (is(k, "using")) {
+            if (is(k + 1, "namespace")) {
+                result.opaque = true;
+            } else if (is(k + 2, "=")) {
+                add(k + 1);
+            } else {
+                add(i - 1);
+            }
+        } else if (is(k, "typedef")) {
+            size_t name = i - 1;
+            for (size_t p = k; p + 2 < i; p++) {
+                if (is(p, "(") && (is(p + 1, "*") || is(p + 1, "&"))) {
+                    name = p + 2;
+                    break;
+                }
+            }
+            while (name > k && is(name, "]")) {
+                while (name > k && !is(name, "[")) name--;
+                name--;
+            }
+            add(name);
+        } else if (is(k, "enum") || is(k, "class") || is(k, "struct") || is(k, "union") || is(k, "template")) {
+            // declared elsewhere or forward, no definition to forward declare from
+            size_t end = k + 1;
+            while (end < i && !is(end, ":")) end++;
+            add(end - 1);
+        } else if (!is(k, "static_assert")) {
+            addDeclared(statement, i);
+        }
+        statement = i + 1;
+    }
+    return result;
+}
+
+// A project include that the header needs only for pointers and references to its classes
+struct ForwardDeclaredInclude {
+    IncludeDirective include;
+    std::vector<std::string> classes;   // the classes the header uses
+    std::string declarations;           // their forward declarations, put in place of the include
+};
+
+// Project includes (`#include "..."`) of a header that can be replaced with forward declarations of their classes and moved
+// into its generated `.cpp`: what is left of the header after extraction uses the classes only as pointers or references
+// (and doesn't use those pointers beyond passing them around), and uses nothing else that the included header, or anything
+// it includes, declares. Decided from names and tokens, and conservative about it: includes that can't be resolved, are
+// inside #if blocks or braces, define macros or whose classes are templates with default arguments stay where they are.
+// Project headers are expected to include what they use themselves, and not to count on an include that came before them
+inline std::vector<ForwardDeclaredInclude> forwardDeclarableIncludes(
+    std::string_view code,
+    const Extraction& extraction,
+    const IncludeResolver& resolve
+) {
+    auto [ifdefs, cleared] = parseIfDefs(code);
+    auto includes = includeDirectives(ifdefs, cleared);
+    if (std::none_of(includes.begin(), includes.end(), [](const IncludeDirective& include) { return !include.angled && !include.header.empty(); })) {
+        return {};
+    }
+
+    // an include with its own includes, as far as they can be followed
+    struct Closure {
+        std::vector<ClassDeclaration> classes;
+        std::set<std::string, std::less<>> names, angled;
+        bool opaque = false;
+    };
+    const size_t MAX_CLOSURE = 256;
+    auto closureOf = [&](const std::string& header) {
+        Closure closure;
+        auto found = resolve("", header);
+        if (!found) {
+            closure.opaque = true;
+            return closure;
+        }
+        std::set<std::string> visited = { found->first };
+        std::vector<std::pair<std::string, std::string>> queue = { std::move(*found) };
+        for (size_t n = 0; n < queue.size() && !closure.opaque; n++) {
+            auto declarations = headerDeclarations(queue[n].second);
+            closure.opaque |= declarations.opaque;
+            for (auto& declared : declarations.classes) {
+                if (n == 0) {
+                    closure.classes.push_back(std::move(declared));
+                } else {
+                    closure.names.insert(std::move(declared.name));
+                }
+            }
+            closure.names.merge(declarations.names);
+            for (const auto& include : declarations.includes) {
+                if (include.header.empty()) {
+                    closure.opaque = true;
+                } else if (include.angled) {
+                    closure.angled.insert(include.header);
+                } else if (auto next = resolve(queue[n].first, include.header)) {
+                    if (visited.insert(next->first).second) queue.push_back(std::move(*next));
+                } else {
+                    closure.opaque = true;
+                }
+            }
+            if (queue.size() > MAX_CLOSURE) closure.opaque = true;
+        }
+        return closure;
+    };
+
+    // only includes at the top level, where the declarations can go as they are
+    std::set<std::string> macros;
+    auto original = tokenize(cleared, macros);
+    std::vector<int> depths;
+    {
+        int depth = 0;
+        size_t t = 0;
+        for (const auto& include : includes) {
+            for (; t < original.size() && original[t].start < include.start; t++) {
+                if (original[t].text == "{") depth++;
+                if (original[t].text == "}") depth--;
+            }
+            depths.push_back(depth);
+        }
+    }
+
+    struct Candidate {
+        IncludeDirective include;
+        Closure closure;
+        std::set<std::string> used;
+        bool blocked = false;
+    };
+    std::vector<Candidate> candidates;
+    std::set<std::string, std::less<>> provided, ownAngled;
+    std::map<std::string, Closure> closures;
+    for (size_t n = 0; n < includes.size(); n++) {
+        const auto& include = includes[n];
+        if (include.angled) {
+            if (include.unconditional) ownAngled.insert(include.header);
+            continue;
+        }
+        if (include.header.empty()) continue;
+        auto it = closures.find(include.header);
+        if (it == closures.end()) it = closures.emplace(include.header, closureOf(include.header)).first;
+        const auto& closure = it->second;
+        if (!closure.opaque && include.unconditional && depths[n] == 0) {
+            candidates.push_back({ include, closure, {}, false });
+        } else {
+            // stays, along with everything it brings
+            for (const auto& declared : closure.classes) provided.insert(declared.name);
+            provided.insert(closure.names.begin(), closure.names.end());
+            ownAngled.insert(closure.angled.begin(), closure.angled.end());
+        }
+    }
+    if (candidates.empty()) return {};
+
+    std::map<std::string_view, std::vector<size_t>> byClass, byName;
+    for (size_t c = 0; c < candidates.size(); c++) {
+        for (const auto& declared : candidates[c].closure.classes) {
+            if (!provided.contains(declared.name)) byClass[declared.name].push_back(c);
+        }
+        for (const auto& name : candidates[c].closure.names) {
+            if (!provided.contains(name)) byName[name].push_back(c);
+        }
+    }
+
+    auto header = EditList(extraction.replacements, static_cast<long>(cleared.size())).apply(cleared);
+    auto tokens = tokenize(header, macros);
+    auto is = [&](size_t k, std::string_view text) { return k < tokens.size() && tokens[k].text == text; };
+    auto isName = [&](size_t k) { return k < tokens.size() && isNameToken(tokens[k]); };
+    auto isBoundary = [&](size_t k) { return is(k, ";") || is(k, "{") || is(k, "}"); };
+    static const std::set<std::string_view> expressionKeywords = {
+        "return", "throw", "delete", "new", "case", "co_return", "co_yield", "co_await", "sizeof", "alignof", "typeid",
+        "decltype", "else", "do", "and", "or", "not"
+    };
+
+    // standard headers that the included ones bring along, and the header doesn't include itself
+    // macros may do anything with what they name
+    auto names = namesInMacros(header);
+    for (auto name : names) {
+        for (const auto* index : { &byClass, &byName }) {
+            if (auto it = index->find(name); it != index->end()) {
+                for (auto c : it->second) candidates[c].blocked = true;
+            }
+        }
+    }
+    for (const auto& token : tokens) {
+        if (isNameToken(token)) names.insert(token.text);
+    }
+    const auto& known = standardHeaderNames();
+    for (auto& candidate : candidates) {
+        for (const auto& angled : candidate.closure.angled) {
+            if (ownAngled.contains(angled)) continue;
+            auto it = known.find(angled);
+            if (it == known.end()) {
+                candidate.blocked = true;
+                break;
+            }
+            for (auto name : it->second) {
+                if (names.contains(name)) candidate.blocked = true;
+            }
+        }
+    }
+
+    // `Name*`, `const Name&`, `Name<T>*`, or `class Name`; the name a pointer is declared with goes to `out_declared`
+    auto isPointerUse = [&](size_t i, std::optional<std::string_view>& out_declared) {
+        size_t prev = i;
+        while (prev >= 2 && is(prev - 1, "::") && isName(prev - 2)) prev -= 2;
+        bool elaborated = prev > 0 && (is(prev - 1, "class") || is(prev - 1, "struct") || is(prev - 1, "union"));
+        if (elaborated && !is(i + 1, "*") && !is(i + 1, "&") && !is(i + 1, "&&")) {
+            return !is(i + 1, "{") && !is(i + 1, ":");
+        }
+        // a downcast needs the whole class, an alias hides what is done with it later
+        if (prev >= 2 && is(prev - 1, "<") && (is(prev - 2, "static_cast") || is(prev - 2, "dynamic_cast") || is(prev - 2, "reinterpret_cast"))) return false;
+        if (prev > 0 && is(prev - 1, "=")) return false;
+
+        size_t j = i + 1;
+        if (is(j, "<")) j = skipAngles(tokens, j);
+        while (is(j, "const") || is(j, "volatile")) j++;
+        if (!is(j, "*") && !is(j, "&") && !is(j, "&&")) return false;
+        while (is(j, "*") || is(j, "&") || is(j, "&&") || is(j, "const") || is(j, "volatile")) j++;
+
+        size_t start = prev;
+        while (start > 0 && !isBoundary(start - 1)) start--;
+        size_t end = j;
+        while (end < tokens.size() && !isBoundary(end)) end++;
+        for (size_t k = start; k < end; k++) {
+            if (is(k, "typedef")) return false;
+            // overrides may return a pointer to a derived class, which takes knowing that it's derived
+            if (is(j + 1, "(") && (is(k, "virtual") || is(k, "override"))) return false;
+        }
+        if (isName(j) && !is(j, "operator")) out_declared = tokens[j].text;
+        return true;
+    };
+
+    std::map<std::string_view, std::set<size_t>> pointers;
+    for (size_t i = 0; i < tokens.size(); i++) {
+        if (!isName(i)) continue;
+        auto text = tokens[i].text;
+        if (auto it = byName.find(text); it != byName.end()) {
+            for (auto c : it->second) candidates[c].blocked = true;
+        }
+        auto it = byClass.find(text);
+        if (it == byClass.end()) continue;
+        std::optional<std::string_view> declared;
+        bool pointer = isPointerUse(i, declared);
+        for (auto c : it->second) {
+            if (!pointer) {
+                candidates[c].blocked = true;
+                continue;
+            }
+            candidates[c].used.emplace(text);
+            if (declared) pointers[*declared].insert(c);
+        }
+    }
+
+    // pointers declared with the classes can be declared again and returned, anything else may need the whole class
+    for (size_t i = 1; i < tokens.size(); i++) {
+        auto it = pointers.find(tokens[i].text);
+        if (it == pointers.end()) continue;
+        size_t prev = i - 1;
+        if (is(prev, "*") || is(prev, "&") || is(prev, "&&")) {
+            while (prev > 0 && (is(prev, "*") || is(prev, "&") || is(prev, "&&") || is(prev, "const"))) prev--;
+            if (is(prev, ">") || (isName(prev) && !expressionKeywords.contains(tokens[prev].text))) continue;
+        } else if (is(prev, "return") && is(i + 1, ";")) {
+            continue;
+        } else if (is(prev, ">") || (isName(prev) && !expressionKeywords.contains(tokens[prev].text))) {
+            continue;
+        }
+        for (auto c : it->second) candidates[c].blocked = true;
+    }
+
+    std::vector<ForwardDeclaredInclude> result;
+    for (auto& candidate : candidates) {
+        if (candidate.blocked) continue;
+        ForwardDeclaredInclude declared{ std::move(candidate.include), {}, "" };
+        for (const auto& declaration : candidate.closure.classes) {
+            if (!candidate.used.contains(declaration.name)) continue;
+            declared.classes.push_back(declaration.name);
+            declared.declarations.append(declaration.declaration).append("\n");
+        }
+        result.push_back(std::move(declared));
+    }
+    return result;
+}
+
+}
+
+#endif
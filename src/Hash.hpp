@@ -0,0 +1,107 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// XXH64 (https://github.com/Cyan4973/xxHash), enough to tell apart file contents
+
+const uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+const uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ULL;
+const uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t xxh_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t xxh_read64(const char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t xxh_read32(const char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME64_2;
+    acc = xxh_rotl(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+inline uint64_t xxh_merge(uint64_t acc, uint64_t val) {
+    acc ^= xxh_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+inline uint64_t hash64(std::string_view data, uint64_t seed = 0) {
+    const char* p = data.data();
+    const char* end = p + data.size();
+    uint64_t h;
+
+    if (data.size() >= 32) {
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+        do {
+            v1 = xxh_round(v1, xxh_read64(p));
+            v2 = xxh_round(v2, xxh_read64(p + 8));
+            v3 = xxh_round(v3, xxh_read64(p + 16));
+            v4 = xxh_round(v4, xxh_read64(p + 24));
+            p += 32;
+        } while (p <= end - 32);
+
+        h = xxh_rotl(v1, 1) + xxh_rotl(v2, 7) + xxh_rotl(v3, 12) + xxh_rotl(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    } else {
+        h = seed + XXH_PRIME64_5;
+    }
+
+    h += data.size();
+
+    while (p + 8 <= end) {
+        h ^= xxh_round(0, xxh_read64(p));
+        h = xxh_rotl(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= static_cast<uint64_t>(xxh_read32(p)) * XXH_PRIME64_1;
+        h = xxh_rotl(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= static_cast<uint8_t>(*p) * XXH_PRIME64_5;
+        h = xxh_rotl(h, 11) * XXH_PRIME64_1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+inline std::string to_hex(uint64_t value) {
+    const char* digits = "0123456789abcdef";
+    std::string s(16, '0');
+    for (int i = 15; i >= 0; i--) {
+        s[i] = digits[value & 0xf];
+        value >>= 4;
+    }
+    return s;
+}
+
+#endif
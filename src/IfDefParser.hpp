@@ -1,69 +1,176 @@
 #ifndef IFDEFPARSER_H
 #define IFDEFPARSER_H
 
-#include <iostream>
-#include <regex>
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <iterator>
+#include <optional>
 #include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
-struct IfRule {
-    bool end;
-    std::string value;
+// Whether `condition` can be combined with others without parentheses
+inline bool isSimpleCondition(const std::string& condition) {
+    return std::all_of(condition.begin(), condition.end(), [](char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '(' || c == ')' || c == '!';
+    });
+}
 
-    [[nodiscard]] std::string toString() const {
-        return "#if " + value;
+inline std::string parenthesized(const std::string& condition) {
+    return isSimpleCondition(condition) ? condition : "(" + condition + ")";
+}
+
+// Conditions of #if blocks by offset. Every directive starts a region of the file, and every region
+// points to its branch in the nesting tree, which knows the conditions of all enclosing branches
+class IfDefIndex {
+public:
+    // `#if`, `#ifdef` and `#ifndef` at `offset` open a nested block with its first branch
+    void open(long offset, const std::string& condition) {
+        branch(offset, current, condition);
     }
-};
 
+    // `#elif` and `#else`: next branch of the innermost block
+    void next(long offset, const std::string& condition) {
+        branch(offset, current >= 0 ? nodes[current].parent : -1, condition);
+    }
 
-std::string stripComments(std::string code) {
-    enum class State {
-        Normal,
-        LineComment,
-        BlockComment
+    // `#endif`
+    void close(long offset) {
+        current = current >= 0 ? nodes[current].parent : -1;
+        regions.emplace_back(offset, current);
+    }
+
+    // `#if` line for code at `offset`, with conditions of all blocks it's nested in
+    [[nodiscard]] std::optional<std::string> at(long offset) const {
+        auto it = std::upper_bound(regions.begin(), regions.end(), offset, [](long x, const std::pair<long, long>& region) {
+            return x < region.first;
+        });
+        if (it == regions.begin() || std::prev(it)->second < 0) {
+            return std::nullopt;
+        }
+        return "#if " + nodes[std::prev(it)->second].expression;
+    }
+
+private:
+    struct Node {
+        long parent;
+        std::string expression; // conditions from the outermost block to this branch
+        std::string chained;    // same, each condition in parentheses when needed, for nested branches to add to
     };
 
-    State state = State::Normal;
-    size_t i = 0;
-    while (i < code.length()) {
-        if (state == State::Normal) {
-            if (code[i] == '/' && i + 1 < code.length()) {
-                if (code[i + 1] == '/') {
-                    state = State::LineComment;
-                    code[i] = ' ';
-                    ++i;
-                    code[i] = ' ';
-                } else if (code[i + 1] == '*') {
-                    state = State::BlockComment;
-                    code[i] = ' ';
-                    ++i;
-                    code[i] = ' ';
-                }
-            }
-        } else if (state == State::LineComment) {
-            if (code[i] == '\n') {
-                state = State::Normal;
-            } else {
-                code[i] = ' ';
-            }
-        } else if (state == State::BlockComment) {
-            if (code[i] == '*' && i + 1 < code.length() && code[i + 1] == '/') {
-                code[i] = ' ';
-                ++i;
-                code[i] = ' ';
-                state = State::Normal;
-            } else {
-                if (code[i] != '\n') {
-                    code[i] = ' ';
-                }
-            }
+    std::vector<Node> nodes;
+    std::vector<std::pair<long, long>> regions;
+    long current = -1;
+
+    void branch(long offset, long parent, const std::string& condition) {
+        auto wrapped = parenthesized(condition);
+        if (parent < 0) {
+            nodes.push_back({ parent, condition, wrapped });
+        } else {
+            auto chained = nodes[parent].chained + " && " + wrapped;
+            nodes.push_back({ parent, chained, chained });
+        }
+        current = static_cast<long>(nodes.size()) - 1;
+        regions.emplace_back(offset, current);
+    }
+};
+
+// The prepass below looks only at these characters, everything in between is skipped 16 or 32 bytes at a time.
+// Line breaks matter only at the end of a directive
+inline size_t findSpecial(const char* data, size_t i, size_t size, bool withNewLines) {
+    const char newLine = withNewLines ? '\n' : '/';
+#if defined(__AVX2__)
+    const __m256i slashes = _mm256_set1_epi8('/'), quotes = _mm256_set1_epi8('"'), apostrophes = _mm256_set1_epi8('\''),
+        newLines = _mm256_set1_epi8(newLine), hashes = _mm256_set1_epi8('#');
+    for (; i + 32 <= size; i += 32) {
+        auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        auto special = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, slashes), _mm256_cmpeq_epi8(chunk, quotes)),
+            _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, apostrophes), _mm256_cmpeq_epi8(chunk, newLines)), _mm256_cmpeq_epi8(chunk, hashes))
+        );
+        if (unsigned mask = _mm256_movemask_epi8(special)) return i + __builtin_ctz(mask);
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i slashes16 = _mm_set1_epi8('/'), quotes16 = _mm_set1_epi8('"'), apostrophes16 = _mm_set1_epi8('\''),
+        newLines16 = _mm_set1_epi8(newLine), hashes16 = _mm_set1_epi8('#');
+    for (; i + 16 <= size; i += 16) {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        auto special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, slashes16), _mm_cmpeq_epi8(chunk, quotes16)),
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, apostrophes16), _mm_cmpeq_epi8(chunk, newLines16)), _mm_cmpeq_epi8(chunk, hashes16))
+        );
+        if (unsigned mask = _mm_movemask_epi8(special)) return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i < size; i++) {
+        char c = data[i];
+        if (c == '/' || c == '"' || c == '\'' || c == newLine || c == '#') return i;
+    }
+    return size;
+}
+
+inline bool isIdentifierChar(char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+// `\` right before the newline at `i`, so the line goes on
+inline bool isContinued(const std::string& code, size_t i) {
+    if (i > 0 && code[i - 1] == '\r') i--;
+    return i > 0 && code[i - 1] == '\\';
+}
+
+// The quote at `i` separates digits, like in `1'000`
+inline bool isDigitSeparator(const std::string& code, size_t i) {
+    size_t k = i;
+    while (k > 0 && (isIdentifierChar(code[k - 1]) || code[k - 1] == '.' || code[k - 1] == '\'')) k--;
+    return k < i && std::isdigit(static_cast<unsigned char>(code[k]));
+}
+
+// End of the string or character literal starting at `i`, or of its line if it's not closed
+inline size_t skipQuoted(const std::string& code, size_t i) {
+    char quote = code[i];
+    for (i++; i < code.size(); i++) {
+        if (code[i] == '\\') {
+            i++;
+        } else if (code[i] == quote) {
+            return i + 1;
+        } else if (code[i] == '\n') {
+            return i;
         }
-        ++i;
     }
+    return code.size();
+}
+
+// End of the raw string if the quote at `i` starts one (`R"delimiter(...)delimiter"`), 0 otherwise
+inline size_t skipRawString(const std::string& code, size_t i) {
+    size_t k = i;
+    while (k > 0 && isIdentifierChar(code[k - 1])) k--;
+    auto prefix = std::string_view(code).substr(k, i - k);
+    if (prefix != "R" && prefix != "u8R" && prefix != "uR" && prefix != "UR" && prefix != "LR") return 0;
 
-    return code;
+    auto open = code.find('(', i + 1);
+    if (open == std::string::npos || open - i - 1 > 16) return 0;
+    auto delimiter = ")" + code.substr(i + 1, open - i - 1) + "\"";
+    auto end = code.find(delimiter, open + 1);
+    return end == std::string::npos ? code.size() : end + delimiter.size();
+}
+
+// Spaces over `[from, to)`, keeping line breaks so offsets and line numbers stay the same
+inline void blank(std::string& code, size_t from, size_t to) {
+    for (size_t k = from; k < to; k++) {
+        if (code[k] != '\n') code[k] = ' ';
+    }
 }
 
-std::string notAccumulated(
+inline std::string notAccumulated(
     const std::vector<std::string>& accumulatedConditions,
     const std::string& but
 ) {
@@ -77,75 +184,112 @@ std::string notAccumulated(
             ss << " || ";
         }
         first = false;
-        ss << c;
+        ss << (accumulatedConditions.size() > 1 ? c : parenthesized(c));
     }
     if (accumulatedConditions.size() > 1)
         ss << ")";
     if (!but.empty()) {
-        ss << " && " << but;
+        ss << " && " << parenthesized(but);
     }
     return ss.str();
 }
 
-std::pair<
-    std::vector<std::pair<long, IfRule>>,
-    std::string
-> parseIfDefs(std::string code) {
-    code = stripComments(code);
-
-    std::vector<std::string> accumulatedConditions;
-    std::vector<std::pair<long, IfRule>> rules;
-    std::vector<std::pair<std::pair<long, long>, std::string>> replacements;
-
-    std::regex directiveRegex(R"(^\s*(#endif|#else|(#if|#ifdef|#ifndef|#elif|#elifdef|#elifndef))\b\s*(.*))");
-
-    std::istringstream stream(code);
-    std::string line;
-    long offset = 0;
-
-    while (std::getline(stream, line)) {
-        std::smatch match;
-        if (std::regex_match(line, match, directiveRegex)) {
-            auto start = offset + match.position(0);
-            auto end = start + match.length(0);
-            code.replace(start, end - start, std::string(end - start, ' '));
-
-            auto dir = match[1].str();
-            if (dir == "#if") {
-                auto condition = match[3].str();
-                rules.emplace_back(start, IfRule{ false, condition });
-                accumulatedConditions.push_back(condition);
-            } else if (dir == "#ifdef") {
-                auto condition = "defined(" + match[3].str() + ")";
-                rules.emplace_back(start, IfRule{ false, condition });
-                accumulatedConditions.push_back(condition);
-            } else if (dir == "#ifndef") {
-                auto condition = "!defined(" + match[3].str() + ")";
-                rules.emplace_back(start, IfRule{ false, condition });
-                accumulatedConditions.push_back(condition);
-            } else if (dir == "#elif") {
-                auto condition = match[3].str();
-                rules.emplace_back(start, IfRule{ false, notAccumulated(accumulatedConditions, condition) });
-                accumulatedConditions.push_back(condition);
-            } else if (dir == "#elifdef") {
-                auto condition = "defined(" + match[3].str() + ")";
-                rules.emplace_back(start, IfRule{ false, notAccumulated(accumulatedConditions, condition) });
-                accumulatedConditions.push_back(condition);
-            } else if (dir == "#elifndef") {
-                auto condition = "!defined(" + match[3].str() + ")";
-                rules.emplace_back(start, IfRule{ false, notAccumulated(accumulatedConditions, condition) });
-                accumulatedConditions.push_back(condition);
-            } else if (dir == "#else") {
-                rules.emplace_back(start, IfRule{ false, notAccumulated(accumulatedConditions, "") });
-            } else if (dir == "#endif") {
-                rules.emplace_back(start, IfRule{ true, "" });
-                accumulatedConditions.clear();
+// Finds #if blocks and blanks comments and conditional directives, so offsets in the result are the same as in `code`.
+// One pass that knows about string, character and raw string literals and line continuations
+inline std::pair<IfDefIndex, std::string> parseIfDefs(std::string_view original) {
+    // conditions of the branches so far, for every open block
+    std::vector<std::vector<std::string>> accumulatedConditions;
+    IfDefIndex ifdefs;
+    // the only copy of the code, which clang gets
+    std::string code(original);
+
+    auto onDirective = [&](const std::string& dir, long start, std::string text) {
+        // continuations and the spaces around the condition don't belong to it
+        for (auto k = text.find('\\'); k != std::string::npos; k = text.find('\\', k)) {
+            auto next = text.find_first_not_of('\r', k + 1);
+            if (next != std::string::npos && text[next] == '\n') {
+                text.erase(k, next + 1 - k);
+            } else {
+                k++;
+            }
+        }
+        trim(text);
+
+        if (dir == "if" || dir == "ifdef" || dir == "ifndef") {
+            auto condition = dir == "if" ? text : (dir == "ifdef" ? "defined(" : "!defined(") + text + ")";
+            ifdefs.open(start, condition);
+            accumulatedConditions.push_back({ condition });
+        } else if (accumulatedConditions.empty()) {
+            // #elif, #else or #endif without #if, nothing to continue
+        } else if (dir == "elif" || dir == "elifdef" || dir == "elifndef") {
+            auto condition = dir == "elif" ? text : (dir == "elifdef" ? "defined(" : "!defined(") + text + ")";
+            ifdefs.next(start, notAccumulated(accumulatedConditions.back(), condition));
+            accumulatedConditions.back().push_back(condition);
+        } else if (dir == "else") {
+            ifdefs.next(start, notAccumulated(accumulatedConditions.back(), ""));
+        } else if (dir == "endif") {
+            ifdefs.close(start);
+            accumulatedConditions.pop_back();
+        }
+    };
+
+    // conditional directive that goes on until the end of its (continued) line
+    std::optional<std::string> directive;
+    size_t lineStart = 0, conditionStart = 0;
+    auto endDirective = [&](size_t end) {
+        onDirective(*directive, static_cast<long>(lineStart), code.substr(conditionStart, end - conditionStart));
+        blank(code, lineStart, end);
+        directive.reset();
+    };
+
+    // `#` starts a directive when there is only whitespace (and blanked comments) before it on its line
+    auto startsLine = [&](size_t i) {
+        while (i > 0 && is_whitespace(code[i - 1]) && code[i - 1] != '\n') i--;
+        if (i > 0 && (code[i - 1] != '\n' || isContinued(code, i - 1))) return false;
+        lineStart = i;
+        return true;
+    };
+
+    size_t size = code.size(), i = 0;
+    while ((i = findSpecial(code.data(), i, size, directive.has_value())) < size) {
+        char c = code[i];
+        if (c == '\n') {
+            if (!isContinued(code, i)) endDirective(i);
+            i++;
+        } else if (c == '/' && i + 1 < size && code[i + 1] == '/') {
+            auto end = code.find('\n', i);
+            while (end != std::string::npos && isContinued(code, end)) end = code.find('\n', end + 1);
+            if (end == std::string::npos) end = size;
+            blank(code, i, end);
+            i = end;
+        } else if (c == '/' && i + 1 < size && code[i + 1] == '*') {
+            auto end = code.find("*/", i + 2);
+            end = end == std::string::npos ? size : end + 2;
+            blank(code, i, end);
+            i = end;
+        } else if (c == '"') {
+            auto end = skipRawString(code, i);
+            i = end ? end : skipQuoted(code, i);
+        } else if (c == '\'') {
+            i = isDigitSeparator(code, i) ? i + 1 : skipQuoted(code, i);
+        } else if (c == '#' && !directive && startsLine(i)) {
+            size_t nameStart = i + 1;
+            while (nameStart < size && (code[nameStart] == ' ' || code[nameStart] == '\t')) nameStart++;
+            size_t nameEnd = nameStart;
+            while (nameEnd < size && isIdentifierChar(code[nameEnd])) nameEnd++;
+            auto name = code.substr(nameStart, nameEnd - nameStart);
+            if (name == "if" || name == "ifdef" || name == "ifndef" || name == "elif" || name == "elifdef" || name == "elifndef" || name == "else" || name == "endif") {
+                directive = name;
+                conditionStart = nameEnd;
             }
+            i = nameEnd;
+        } else {
+            i++;
         }
-        offset += line.size() + 1;
     }
+    if (directive) endDirective(size);
 
-    return { rules, code };
+    return { std::move(ifdefs), std::move(code) };
 }
 
-#endif
\ No newline at end of file
+#endif
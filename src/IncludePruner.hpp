@@ -0,0 +1,376 @@
+#ifndef INCLUDEPRUNER_H
+#define INCLUDEPRUNER_H
+
+#include "EditList.hpp"
+#include "Extraction.hpp"
+#include "IfDefParser.hpp"
+
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace headless {
+
+// Standard headers and the names they are included for. Names that several headers declare are listed in each of them
+inline const std::map<std::string_view, std::vector<std::string_view>>& standardHeaderNames() {
+    static const std::map<std::string_view, std::vector<std::string_view>> names = {
+        { "algorithm", { "sort", "stable_sort", "partial_sort", "nth_element", "find", "find_if", "find_if_not", "count", "count_if",
+            "copy", "copy_if", "copy_n", "transform", "min", "max", "minmax", "min_element", "max_element", "clamp", "fill", "fill_n",
+            "remove", "remove_if", "unique", "reverse", "rotate", "shuffle", "lower_bound", "upper_bound", "binary_search",
+            "equal_range", "all_of", "any_of", "none_of", "for_each", "equal", "mismatch", "search", "move", "swap", "merge",
+            "includes", "set_union", "set_intersection", "set_difference", "replace", "replace_if", "generate", "ranges" } },
+        { "array", { "array", "get", "to_array" } },
+        { "atomic", { "atomic", "atomic_flag", "memory_order", "atomic_thread_fence" } },
+        { "bitset", { "bitset" } },
+        { "cassert", { "assert" } },
+        { "cctype", { "isalpha", "isdigit", "isspace", "isalnum", "isupper", "islower", "ispunct", "isxdigit", "toupper", "tolower" } },
+        { "chrono", { "chrono" } },
+        { "cmath", { "sqrt", "pow", "abs", "fabs", "floor", "ceil", "round", "trunc", "sin", "cos", "tan", "asin", "acos", "atan",
+            "atan2", "exp", "log", "log2", "log10", "fmod", "hypot", "isnan", "isinf", "isfinite", "lerp" } },
+        { "condition_variable", { "condition_variable", "condition_variable_any", "cv_status" } },
+        { "cstdint", { "int8_t", "int16_t", "int32_t", "int64_t", "uint8_t", "uint16_t", "uint32_t", "uint64_t",
+            "intptr_t", "uintptr_t", "intmax_t", "uintmax_t" } },
+        { "cstdio", { "printf", "fprintf", "sprintf", "snprintf", "puts", "fputs", "FILE", "fopen", "fclose", "fread", "fwrite",
+            "fflush", "stdout", "stderr", "stdin", "EOF" } },
+        { "cstdlib", { "malloc", "free", "calloc", "realloc", "exit", "abort", "atoi", "atof", "strtol", "strtoul", "strtod",
+            "getenv", "rand", "srand", "EXIT_SUCCESS", "EXIT_FAILURE" } },
+        { "cstring", { "memcpy", "memset", "memcmp", "memmove", "memchr", "strlen", "strcmp", "strncmp", "strcpy", "strncpy",
+            "strchr", "strrchr", "strstr", "strerror" } },
+        { "deque", { "deque" } },
+        { "filesystem", { "filesystem" } },
+        { "fstream", { "ifstream", "ofstream", "fstream", "basic_ifstream", "basic_ofstream", "basic_fstream", "filebuf" } },
+        { "functional", { "function", "hash", "less", "greater", "equal_to", "bind", "invoke", "reference_wrapper", "ref", "cref",
+            "placeholders" } },
+        { "future", { "future", "promise", "async", "packaged_task", "shared_future", "launch" } },
+        { "iomanip", { "setw", "setprecision", "setfill", "put_time", "get_time", "quoted" } },
+        { "iostream", { "cout", "cin", "cerr", "clog", "wcout", "wcin", "wcerr", "wclog", "istream", "ostream", "iostream",
+            "wistream", "wostream", "endl", "flush", "ends", "ws", "ios", "ios_base", "streambuf", "basic_ostream", "basic_istream" } },
+        { "list", { "list" } },
+        { "map", { "map", "multimap" } },
+        { "memory", { "unique_ptr", "shared_ptr", "weak_ptr", "make_unique", "make_shared", "allocator", "enable_shared_from_this",
+            "default_delete", "static_pointer_cast", "dynamic_pointer_cast", "addressof" } },
+        { "mutex", { "mutex", "lock_guard", "unique_lock", "scoped_lock", "recursive_mutex", "timed_mutex", "once_flag", "call_once",
+            "try_lock", "lock" } },
+        { "numeric", { "accumulate", "iota", "reduce", "inner_product", "partial_sum", "gcd", "lcm", "transform_reduce" } },
+        { "optional", { "optional", "nullopt", "nullopt_t", "make_optional", "bad_optional_access" } },
+        { "queue", { "queue", "priority_queue" } },
+        { "random", { "mt19937", "mt19937_64", "random_device", "uniform_int_distribution", "uniform_real_distribution",
+            "normal_distribution", "bernoulli_distribution", "minstd_rand", "default_random_engine" } },
+        { "regex", { "regex", "wregex", "basic_regex", "regex_match", "regex_search", "regex_replace", "smatch", "cmatch",
+            "wsmatch", "match_results", "sub_match", "ssub_match", "sregex_iterator", "sregex_token_iterator", "regex_error",
+            "regex_constants" } },
+        { "set", { "set", "multiset" } },
+        { "span", { "span", "dynamic_extent" } },
+        { "sstream", { "stringstream", "istringstream", "ostringstream", "basic_stringstream", "stringbuf" } },
+        { "stack", { "stack" } },
+        { "stdexcept", { "runtime_error", "logic_error", "invalid_argument", "out_of_range", "domain_error", "length_error",
+            "overflow_error", "underflow_error", "range_error" } },
+        { "string", { "string", "wstring", "u8string", "u16string", "u32string", "basic_string", "char_traits", "to_string",
+            "to_wstring", "stoi", "stol", "stoll", "stoul", "stoull", "stof", "stod", "getline" } },
+        { "string_view", { "string_view", "wstring_view", "basic_string_view" } },
+        { "thread", { "thread", "jthread", "this_thread" } },
+        { "tuple", { "tuple", "make_tuple", "tie", "get", "tuple_size", "tuple_element", "apply", "forward_as_tuple", "tuple_cat" } },
+        { "type_traits", { "is_same", "is_same_v", "enable_if", "enable_if_t", "decay", "decay_t", "remove_reference",
+            "remove_reference_t", "remove_cv", "remove_cvref", "remove_cvref_t", "conditional", "conditional_t", "is_integral",
+            "is_integral_v", "is_floating_point", "is_base_of", "is_convertible", "integral_constant", "true_type", "false_type",
+            "underlying_type", "underlying_type_t", "invoke_result", "invoke_result_t" } },
+        { "unordered_map", { "unordered_map", "unordered_multimap" } },
+        { "unordered_set", { "unordered_set", "unordered_multiset" } },
+        { "utility", { "pair", "make_pair", "move", "forward", "swap", "exchange", "declval", "get", "index_sequence",
+            "make_index_sequence", "integer_sequence", "in_place", "as_const" } },
+        { "variant", { "variant", "visit", "monostate", "holds_alternative", "get", "get_if", "bad_variant_access" } },
+        { "vector", { "vector" } },
+    };
+    return names;
+}
+
+// Standard headers provide these one way or another, so any of them that is kept is enough
+inline bool isCommonStandardName(std::string_view name) {
+    return name == "size_t" || name == "ptrdiff_t" || name == "nullptr_t" || name == "byte";
+}
+
+struct IncludeDirective {
+    long start, end;            // the directive with its line break
+    std::string header;         // as written between `<>` or `""`, empty when it's neither
+    bool angled = false;
+    bool unconditional = true;  // not inside an #if block, other than the include guard
+};
+
+// `#if` line of the include guard of `cleared` (code after `parseIfDefs`), if it has one
+inline std::optional<std::string> includeGuard(const IfDefIndex& ifdefs, std::string_view cleared) {
+    auto first = cleared.find_first_not_of(ws);
+    if (first == std::string_view::npos) return std::nullopt;
+    auto condition = ifdefs.at(static_cast<long>(first));
+    auto define = cleared.substr(first);
+    if (!condition || !condition->starts_with("#if !defined(") || !define.starts_with("#define")) return std::nullopt;
+    auto macro = condition->substr(13, condition->size() - 14);
+    auto defined = std::string(define.substr(7, define.find('\n') - 7));
+    if (trim(defined) != macro) return std::nullopt;
+    return condition;
+}
+
+// `#include` at the start of `line`, the header name for `<...>` or `"..."` (empty for neither)
+inline std::optional<std::string_view> includedHeader(std::string_view line, bool& out_angled) {
+    auto i = line.find_first_not_of(" \t");
+    if (i == std::string_view::npos || line[i] != '#') return std::nullopt;
+    i = line.find_first_not_of(" \t", i + 1);
+    if (i == std::string_view::npos || line.substr(i, 7) != "include") return std::nullopt;
+    i = line.find_first_not_of(" \t", i + 7);
+    out_angled = false;
+    if (i == std::string_view::npos) return std::string_view();
+    char close = line[i] == '<' ? '>' : (line[i] == '"' ? '"' : 0);
+    auto end = close ? line.find(close, i + 1) : std::string_view::npos;
+    out_angled = close == '>';
+    return end == std::string_view::npos ? std::string_view() : line.substr(i + 1, end - i - 1);
+}
+
+// Every `#include` of `cleared`, in order
+inline std::vector<IncludeDirective> includeDirectives(const IfDefIndex& ifdefs, std::string_view cleared) {
+    auto guard = includeGuard(ifdefs, cleared);
+    std::vector<IncludeDirective> includes;
+    for (size_t start = 0; start < cleared.size();) {
+        auto end = cleared.find('\n', start);
+        if (end == std::string_view::npos) end = cleared.size();
+        bool angled = false;
+        if (auto header = includedHeader(cleared.substr(start, end - start), angled)) {
+            auto condition = ifdefs.at(static_cast<long>(start));
+            includes.push_back({
+                static_cast<long>(start),
+                static_cast<long>(std::min(end + 1, cleared.size())),
+                std::string(*header),
+                angled,
+                !condition || condition == guard
+            });
+        }
+        start = end + 1;
+    }
+    return includes;
+}
+
+// Spelled as macros are: upper case letters, digits and underscores. Predefined ones (`__FILE__`, `__cplusplus`) don't count
+inline bool isMacroName(std::string_view name) {
+    if (name.size() < 2 || name.starts_with("__")) return false;
+    bool letter = false;
+    for (char c : name) {
+        if (c >= 'A' && c <= 'Z') letter = true;
+        else if ((c < '0' || c > '9') && c != '_') return false;
+    }
+    return letter;
+}
+
+// Keywords, and other names that nothing declares (attributes, `std`)
+inline const std::set<std::string_view>& reservedNames() {
+    static const std::set<std::string_view> names = {
+        "alignas", "alignof", "and", "asm", "auto", "bool", "break", "case", "catch", "char", "char8_t", "char16_t", "char32_t",
+        "class", "co_await", "co_return", "co_yield", "concept", "const", "consteval", "constexpr", "constinit", "const_cast",
+        "continue", "decltype", "default", "delete", "do", "double", "dynamic_cast", "else", "enum", "explicit", "export",
+        "extern", "false", "final", "float", "for", "friend", "goto", "if", "inline", "int", "long", "mutable", "namespace",
+        "new", "noexcept", "not", "nullptr", "operator", "or", "override", "private", "protected", "public", "register",
+        "reinterpret_cast", "requires", "return", "short", "signed", "sizeof", "static", "static_assert", "static_cast",
+        "struct", "switch", "template", "this", "thread_local", "throw", "true", "try", "typedef", "typeid", "typename",
+        "union", "unsigned", "using", "virtual", "void", "volatile", "wchar_t", "while",
+        "nodiscard", "maybe_unused", "deprecated", "noreturn", "fallthrough", "likely", "unlikely", "std"
+    };
+    return names;
+}
+
+// Keywords a declared name can follow, like a type does: `int count`, `unsigned long size`
+inline bool isTypeKeyword(std::string_view name) {
+    return name == "auto" || name == "bool" || name == "char" || name == "char8_t" || name == "char16_t" || name == "char32_t"
+        || name == "double" || name == "float" || name == "int" || name == "long" || name == "short" || name == "signed"
+        || name == "unsigned" || name == "void" || name == "wchar_t";
+}
+
+// A name in `header` (code after `parseIfDefs`) that the header doesn't declare itself and isn't in `known`, like `va_list`
+// in `void log(const char*, va_list);`. Without resolving anything a name counts as declared where it comes right after
+// a type (`int count`, `T* next`, `typename T`), before `(`, after `class`, `struct`, `union`, `enum`, `namespace`, `using`
+// or `concept`, and in the braces of an `enum`. Members (after `.`, `->` and `::`), macros and directives aren't looked at
+inline std::optional<std::string_view> undeclaredName(std::string_view header, const std::set<std::string_view>& known) {
+    const auto& reserved = reservedNames();
+    // names and punctuation, with `::` and `->` as one token; literals are skipped
+    std::vector<std::string_view> tokens;
+    auto isName = [](std::string_view token) {
+        return isIdentifierChar(token[0]) && (token[0] < '0' || token[0] > '9');
+    };
+    for (size_t i = 0; i < header.size();) {
+        char c = header[i];
+        if (c == '#') {
+            // a directive, with its continued lines
+            auto end = header.find('\n', i);
+            while (end != std::string_view::npos && end > 0 && header[end - 1] == '\\') end = header.find('\n', end + 1);
+            i = end == std::string_view::npos ? header.size() : end;
+        } else if (c == '"' || c == '\'') {
+            auto end = i + 1;
+            while (end < header.size() && header[end] != c && header[end] != '\n') end += header[end] == '\\' ? 2 : 1;
+            i = end + 1;
+        } else if (isIdentifierChar(c)) {
+            auto end = i;
+            // digit separators are part of a number
+            bool number = c >= '0' && c <= '9';
+            while (end < header.size() && (isIdentifierChar(header[end]) || (number && header[end] == '\''))) end++;
+            // not the prefix of a literal (`L'a'`, `u8"a"`)
+            bool prefix = end < header.size() && (header[end] == '"' || header[end] == '\'');
+            if (isName(header.substr(i, end - i)) && !prefix) tokens.push_back(header.substr(i, end - i));
+            i = end;
+        } else if (header.compare(i, 2, "::") == 0 || header.compare(i, 2, "->") == 0) {
+            tokens.push_back(header.substr(i, 2));
+            i += 2;
+        } else {
+            if (std::string_view(ws).find(c) == std::string_view::npos) tokens.push_back(header.substr(i, 1));
+            i++;
+        }
+    }
+
+    std::set<std::string_view> declared;
+    bool inEnum = false;
+    for (size_t i = 0; i < tokens.size(); i++) {
+        auto token = tokens[i];
+        if (token == "{" && i > 0) {
+            // `enum class E : int {`
+            for (size_t j = i; j-- > 0 && tokens[j] != ";" && tokens[j] != "}" && tokens[j] != "{";) {
+                if (tokens[j] == "enum") inEnum = true;
+            }
+        }
+        if (token == "}") inEnum = false;
+        if (!isName(token)) continue;
+        auto previous = i > 0 ? tokens[i - 1] : std::string_view();
+        auto next = i + 1 < tokens.size() ? tokens[i + 1] : std::string_view();
+        bool afterType = !previous.empty() && ((isName(previous) && (!reserved.contains(previous) || isTypeKeyword(previous) || previous == "typename" || previous == "class"))
+            || previous == "*" || previous == "&" || previous == ">");
+        bool declarator = next == ";" || next == "," || next == ")" || next == "=" || next == "[" || next == "{" || next == ":" || next == ">" || next == "(";
+        if (next == "(" || (afterType && declarator) || inEnum || previous == "class" || previous == "struct" || previous == "union"
+            || previous == "enum" || previous == "namespace" || previous == "using" || previous == "concept") {
+            declared.insert(token);
+        }
+    }
+
+    for (size_t i = 0; i < tokens.size(); i++) {
+        auto token = tokens[i];
+        if (!isName(token) || reserved.contains(token) || token.starts_with("__") || isMacroName(token)) continue;
+        if (i > 0 && (tokens[i - 1] == "." || tokens[i - 1] == "->" || tokens[i - 1] == "::")) continue;
+        if (!declared.contains(token) && !known.contains(token) && !isCommonStandardName(token)) return token;
+    }
+    return std::nullopt;
+}
+
+// Standard library includes of a header that can move into its generated `.cpp`: nothing left in the header
+// (declarations, inline functions, macros) uses any of their names, and the rest doesn't seem to rely on them either.
+// Without resolving includes this is decided by names only, and stays conservative: when the header uses a standard
+// name that no kept include is known to provide (so it may come through a moved one), nothing moves.
+// Includes inside #if blocks (other than the include guard), followed by includes of unknown headers
+// (that may count on what came before them), in headers with `using namespace std` or that use unknown macros
+// or names they don't declare (see `undeclaredName`) stay where they are
+inline std::vector<IncludeDirective> movableIncludes(std::string_view code, const Extraction& extraction) {
+    auto [ifdefs, cleared] = parseIfDefs(code);
+    const auto& known = standardHeaderNames();
+
+    std::vector<IncludeDirective> candidates;
+    std::set<std::string> kept;
+    for (auto& include : includeDirectives(ifdefs, cleared)) {
+        if (include.angled && known.contains(include.header) && include.unconditional) {
+            candidates.push_back(std::move(include));
+        } else if (include.angled && known.contains(include.header)) {
+            kept.insert(include.header);
+        } else {
+            // an unknown header may need whatever was included before it
+            for (const auto& candidate : candidates) kept.insert(candidate.header);
+            candidates.clear();
+        }
+    }
+    if (candidates.empty()) return {};
+
+    // names in what is left of the header, those right after `std::` separately
+    auto header = EditList(extraction.replacements, static_cast<long>(cleared.size())).apply(cleared);
+    std::set<std::string_view> used, qualified;
+    auto startsLine = [&](size_t i) {
+        auto before = i == 0 ? std::string::npos : header.find_last_not_of(" \t", i - 1);
+        return before == std::string::npos || header[before] == '\n';
+    };
+    for (size_t i = 0; i < header.size();) {
+        if (header[i] == '#' && startsLine(i)) {
+            bool angled;
+            auto end = header.find('\n', i);
+            if (end == std::string::npos) end = header.size();
+            if (includedHeader(std::string_view(header).substr(i, end - i), angled)) {
+                i = end;
+                continue;
+            }
+        }
+        if (!isIdentifierChar(header[i]) || (i > 0 && isIdentifierChar(header[i - 1]))) {
+            i++;
+            continue;
+        }
+        size_t end = i;
+        while (end < header.size() && isIdentifierChar(header[end])) end++;
+        auto name = std::string_view(header).substr(i, end - i);
+        used.insert(name);
+        if (name == "std") {
+            auto next = header.find_first_not_of(ws, end);
+            if (next != std::string::npos && header.compare(next, 2, "::") == 0) {
+                auto start = header.find_first_not_of(ws, next + 2);
+                size_t nameEnd = start;
+                while (nameEnd < header.size() && isIdentifierChar(header[nameEnd])) nameEnd++;
+                if (start != std::string::npos && nameEnd > start) qualified.insert(std::string_view(header).substr(start, nameEnd - start));
+            }
+        }
+        i = end;
+    }
+    if (header.find("using namespace std") != std::string::npos) return {};
+
+    // macros aren't resolved either: one that isn't known nor defined here (`UINT32_MAX`, `M_PI`) may come from any include
+    std::set<std::string_view> defined;
+    for (size_t i = header.find("#define"); i != std::string::npos; i = header.find("#define", i + 1)) {
+        auto start = header.find_first_not_of(" \t", i + 7);
+        size_t end = start;
+        while (end < header.size() && isIdentifierChar(header[end])) end++;
+        if (start != std::string::npos && end > start) defined.insert(std::string_view(header).substr(start, end - start));
+    }
+    std::set<std::string_view> standard;
+    for (const auto &[include, names] : known) standard.insert(names.begin(), names.end());
+    for (auto name : used) {
+        if (isMacroName(name) && !defined.contains(name) && !standard.contains(name)) return {};
+    }
+    // nor can any other name that isn't declared here and isn't a known standard one (`va_list` may come from <cstdio>)
+    standard.insert(defined.begin(), defined.end());
+    if (undeclaredName(header, standard)) return {};
+
+    std::vector<IncludeDirective> movable;
+    for (auto& candidate : candidates) {
+        bool needed = false;
+        for (auto name : known.at(candidate.header)) {
+            if (used.contains(name)) needed = true;
+        }
+        if (needed) {
+            kept.insert(candidate.header);
+        } else {
+            movable.push_back(std::move(candidate));
+        }
+    }
+    if (movable.empty()) return {};
+
+    // every standard name the header uses has to come from an include that stays.
+    // C++ names count with `std::`, names of the C library and macros also without it
+    std::set<std::string_view> provided, unqualified;
+    for (const auto& name : kept) {
+        provided.insert(known.at(name).begin(), known.at(name).end());
+    }
+    for (const auto* c : { "cassert", "cctype", "cmath", "cstdint", "cstdio", "cstdlib", "cstring" }) {
+        unqualified.insert(known.at(c).begin(), known.at(c).end());
+    }
+    for (auto name : used) {
+        if (isCommonStandardName(name)) {
+            if (kept.empty()) return {};
+            continue;
+        }
+        bool isStandard = qualified.contains(name) || unqualified.contains(name);
+        if (isStandard && !provided.contains(name)) return {};
+    }
+    return movable;
+}
+
+}
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef IORING_H
+#define IORING_H
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <utility>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Just enough of io_uring for batches of opens, reads, writes, renames and closes, over raw syscalls (no liburing).
+// Operations are queued, submitted together with one syscall, and complete in any order under their tag.
+// Not thread-safe, one thread owns a ring
+class IoRing {
+public:
+    explicit IoRing(unsigned entries) {
+        io_uring_params params{};
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0) return;
+
+        sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sq_size = cq_size = std::max(sq_size, cq_size);
+
+        sq_ring = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_ring == MAP_FAILED) {
+            release();
+            return;
+        }
+        cq_ring = single ? sq_ring : mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED) {
+            release();
+            return;
+        }
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        auto sqes_mapping = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqes_mapping == MAP_FAILED) {
+            release();
+            return;
+        }
+        sqes = static_cast<io_uring_sqe*>(sqes_mapping);
+
+        auto sq = static_cast<char*>(sq_ring);
+        sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sq_entries = params.sq_entries;
+        tail = *sq_tail;
+
+        auto cq = static_cast<char*>(cq_ring);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    }
+
+    ~IoRing() {
+        release();
+    }
+
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    // Not supported by the kernel, or not allowed (seccomp, `io_uring_disabled`)
+    [[nodiscard]] bool valid() const {
+        return fd >= 0 && sqes;
+    }
+
+    [[nodiscard]] unsigned capacity() const {
+        return sq_entries;
+    }
+
+    // Each of these returns false when the submission queue is full.
+    // `path` and `buffer` have to stay alive until the operation completes
+    bool open(const char* path, uint64_t tag) {
+        auto sqe = next();
+        if (!sqe) return false;
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uint64_t>(path);
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        sqe->user_data = tag;
+        return true;
+    }
+
+    // Creates `path` for writing, or truncates it
+    bool create(const char* path, uint64_t tag) {
+        auto sqe = next();
+        if (!sqe) return false;
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uint64_t>(path);
+        sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        sqe->len = 0666;
+        sqe->user_data = tag;
+        return true;
+    }
+
+    bool read(int file, void* buffer, unsigned size, uint64_t tag) {
+        auto sqe = next();
+        if (!sqe) return false;
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = file;
+        sqe->addr = reinterpret_cast<uint64_t>(buffer);
+        sqe->len = size;
+        sqe->off = 0;
+        sqe->user_data = tag;
+        return true;
+    }
+
+    bool write(int file, const void* buffer, unsigned size, uint64_t tag) {
+        auto sqe = next();
+        if (!sqe) return false;
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = file;
+        sqe->addr = reinterpret_cast<uint64_t>(buffer);
+        sqe->len = size;
+        sqe->off = 0;
+        sqe->user_data = tag;
+        return true;
+    }
+
+    // Needs Linux 5.11, older kernels complete it with -EINVAL
+    bool rename(const char* from, const char* to, uint64_t tag) {
+        auto sqe = next();
+        if (!sqe) return false;
+        sqe->opcode = IORING_OP_RENAMEAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uint64_t>(from);
+        sqe->len = static_cast<uint32_t>(AT_FDCWD);
+        sqe->addr2 = reinterpret_cast<uint64_t>(to);
+        sqe->user_data = tag;
+        return true;
+    }
+
+    // Starts reading the whole file into the page cache, without copying it anywhere
+    bool readahead(int file, uint64_t tag) {
+        auto sqe = next();
+        if (!sqe) return false;
+        sqe->opcode = IORING_OP_FADVISE;
+        sqe->fd = file;
+        sqe->off = 0;
+        sqe->len = 0;
+        sqe->fadvise_advice = POSIX_FADV_WILLNEED;
+        sqe->user_data = tag;
+        return true;
+    }
+
+    bool close(int file, uint64_t tag) {
+        auto sqe = next();
+        if (!sqe) return false;
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = file;
+        sqe->user_data = tag;
+        return true;
+    }
+
+    // Submits everything queued and waits until at least `wait` operations are complete
+    bool submit(unsigned wait) {
+        // the kernel only looks at the queue here, so filled entries are published all at once
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+        while (true) {
+            auto result = syscall(__NR_io_uring_enter, fd, queued, wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (result >= 0) {
+                queued -= static_cast<unsigned>(result);
+                if (queued == 0) return true;
+                continue;
+            }
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY) return false;
+        }
+    }
+
+    // A completed operation: its tag and result (file descriptor, bytes read or written, or -errno)
+    std::optional<std::pair<uint64_t, int>> reap() {
+        auto head = *cq_head;
+        if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) return std::nullopt;
+        const auto& cqe = cqes[head & cq_mask];
+        std::pair<uint64_t, int> completion = { cqe.user_data, cqe.res };
+        __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+        return completion;
+    }
+
+private:
+    int fd = -1;
+    void* sq_ring = MAP_FAILED;
+    void* cq_ring = MAP_FAILED;
+    size_t sq_size = 0, cq_size = 0, sqes_size = 0;
+    io_uring_sqe* sqes = nullptr;
+    unsigned *sq_head = nullptr, *sq_tail = nullptr, *sq_array = nullptr;
+    unsigned *cq_head = nullptr, *cq_tail = nullptr;
+    unsigned sq_mask = 0, cq_mask = 0, sq_entries = 0;
+    io_uring_cqe* cqes = nullptr;
+    unsigned tail = 0, queued = 0;
+
+    io_uring_sqe* next() {
+        if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) return nullptr;
+        auto index = tail & sq_mask;
+        auto sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sq_array[index] = index;
+        tail++;
+        queued++;
+        return sqe;
+    }
+
+    void release() {
+        if (sqes) munmap(sqes, sqes_size);
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring) munmap(cq_ring, cq_size);
+        if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_size);
+        if (fd >= 0) ::close(fd);
+        sqes = nullptr;
+        sq_ring = cq_ring = MAP_FAILED;
+        fd = -1;
+    }
+};
+
+#endif
+
+#endif
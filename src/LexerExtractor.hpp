@@ -0,0 +1,932 @@
+#ifndef LEXEREXTRACTOR_H
+#define LEXEREXTRACTOR_H
+
+#include "IfDefParser.hpp"
+#include "Extraction.hpp"
+#include "LineIndex.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace headless {
+
+// `--engine=lexer`: finds the same definitions as `ImplementationExtractor` from tokens and brace nesting only,
+// without clang's semantic analysis. Whenever a declaration has a shape it can't be sure about
+// (templated classes, `auto`, macros, unusual declarators...), it gives up and clang is used for the whole file
+
+struct Token {
+    enum Kind : uint8_t {
+        Identifier,  // also keywords
+        Number,
+        String,      // string and character literals
+        Punct
+    };
+
+    Kind kind;
+    uint32_t start;
+    std::string_view text;
+
+    [[nodiscard]] long end() const {
+        return start + static_cast<long>(text.size());
+    }
+};
+
+inline bool is_identifier_char(char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '$';
+}
+
+// Tokens of `code`, that should already be without comments. Preprocessor directives are skipped,
+// names of macros they define go to `out_macros`
+inline std::vector<Token> tokenize(std::string_view code, std::set<std::string>& out_macros) {
+    static const char* puncts[] = {
+        "<<=", ">>=", "<=>", "->*", "...",
+        "::", "->", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||", "++", "--",
+        "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=", ".*", "##"
+    };
+
+    std::vector<Token> tokens;
+    long size = static_cast<long>(code.size());
+    long i = 0;
+    bool lineStart = true;
+    auto token = [&](Token::Kind kind, long start) {
+        tokens.push_back({ kind, static_cast<uint32_t>(start), code.substr(start, i - start) });
+        lineStart = false;
+    };
+
+    while (i < size) {
+        char c = code[i];
+        if (c == '\n') {
+            lineStart = true;
+            i++;
+            continue;
+        }
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v') {
+            i++;
+            continue;
+        }
+        if (c == '\\' && i + 1 < size && code[i + 1] == '\n') {
+            i += 2;
+            continue;
+        }
+
+        if (c == '#' && lineStart) {
+            long start = i;
+            while (i < size && code[i] != '\n') {
+                if (code[i] == '\\' && i + 1 < size && code[i + 1] == '\n') i++;
+                i++;
+            }
+            auto directive = code.substr(start + 1, i - start - 1);
+            auto name = directive.find_first_not_of(" \t");
+            if (name != std::string_view::npos && directive.substr(name, 6) == "define") {
+                auto macro = directive.find_first_not_of(" \t", name + 6);
+                if (macro != std::string_view::npos) {
+                    auto macroEnd = macro;
+                    while (macroEnd < directive.size() && is_identifier_char(directive[macroEnd])) macroEnd++;
+                    out_macros.emplace(directive.substr(macro, macroEnd - macro));
+                }
+            }
+            continue;
+        }
+
+        long start = i;
+        if (is_identifier_char(c) && !std::isdigit(static_cast<unsigned char>(c))) {
+            while (i < size && is_identifier_char(code[i])) i++;
+            auto word = code.substr(start, i - start);
+            bool isStringPrefix = word == "L" || word == "u" || word == "U" || word == "u8" || word == "R" || word == "LR" || word == "uR" || word == "UR" || word == "u8R";
+            if (isStringPrefix && i < size && (code[i] == '"' || (code[i] == '\'' && word.back() != 'R'))) {
+                if (word.back() == 'R' && code[i] == '"') {
+                    // raw string: R"delim( ... )delim"
+                    auto open = code.find('(', i);
+                    if (open == std::string_view::npos) {
+                        i = size;
+                    } else {
+                        std::string close = ")" + std::string(code.substr(i + 1, open - i - 1)) + "\"";
+                        auto end = code.find(close, open);
+                        i = end == std::string_view::npos ? size : static_cast<long>(end + close.size());
+                    }
+                    token(Token::String, start);
+                    continue;
+                }
+                c = code[i];
+            } else {
+                token(Token::Identifier, start);
+                continue;
+            }
+        }
+
+        if (c == '"' || c == '\'') {
+            i++;
+            while (i < size && code[i] != c && code[i] != '\n') {
+                if (code[i] == '\\' && i + 1 < size) i++;
+                i++;
+            }
+            if (i < size && code[i] == c) i++;
+            token(Token::String, start);
+            continue;
+        }
+
+        if (std::isdigit(static_cast<unsigned char>(c)) || (c == '.' && i + 1 < size && std::isdigit(static_cast<unsigned char>(code[i + 1])))) {
+            while (i < size) {
+                char d = code[i];
+                if ((d == '+' || d == '-') && (code[i - 1] == 'e' || code[i - 1] == 'E' || code[i - 1] == 'p' || code[i - 1] == 'P')) {
+                    i++;
+                } else if (is_identifier_char(d) || d == '.' || (d == '\'' && i + 1 < size && is_identifier_char(code[i + 1]))) {
+                    i++;
+                } else {
+                    break;
+                }
+            }
+            token(Token::Number, start);
+            continue;
+        }
+
+        long length = 1;
+        for (const auto* p : puncts) {
+            auto punct = std::string_view(p);
+            if (code.substr(i, punct.size()) == punct) {
+                length = static_cast<long>(punct.size());
+                break;
+            }
+        }
+        i += length;
+        token(Token::Punct, start);
+    }
+    return tokens;
+}
+
+class LexerExtractor {
+public:
+    LexerExtractor(const IfDefIndex& ifdefs, std::string_view code) :
+    ifdefs(ifdefs), code(code), lines(code) {
+        tokens = tokenize(code, macros);
+    }
+
+    // Meant to be the same result as `ImplementationExtractor` (the `engines` test compares them over `test/`),
+    // or nothing if the header has to go through clang
+    std::optional<Extraction> extract() {
+        size_t i = 0;
+        if (!parseScope(i) || i != tokens.size()) {
+            return std::nullopt;
+        }
+        extraction.replacements = std::move(replacements);
+        return std::move(extraction);
+    }
+
+private:
+    struct Scope {
+        enum Kind { Namespace, Record, Transparent };
+        Kind kind;
+        std::string name;
+    };
+
+    const IfDefIndex& ifdefs;
+    std::string_view code;
+    std::vector<Token> tokens;
+    std::set<std::string> macros;
+    LineIndex lines;
+    std::vector<Scope> scopes;
+
+    Extraction extraction;
+    std::vector<std::pair<std::pair<long, long>, std::string>> replacements;
+
+    [[nodiscard]] bool is(size_t i, std::string_view text) const {
+        return i < tokens.size() && tokens[i].text == text;
+    }
+
+    [[nodiscard]] bool isIdentifier(size_t i) const {
+        return i < tokens.size() && tokens[i].kind == Token::Identifier;
+    }
+
+    static bool isKeyword(std::string_view word) {
+        static const std::set<std::string_view> keywords = {
+            "alignas", "alignof", "asm", "auto", "bool", "break", "case", "catch", "char", "char8_t", "char16_t",
+            "char32_t", "class", "concept", "const", "consteval", "constexpr", "constinit", "const_cast", "continue",
+            "co_await", "co_return", "co_yield", "decltype", "default", "delete", "do", "double", "dynamic_cast",
+            "else", "enum", "explicit", "export", "extern", "false", "float", "for", "friend", "goto", "if", "inline",
+            "int", "long", "mutable", "namespace", "new", "noexcept", "nullptr", "operator", "private", "protected",
+            "public", "register", "reinterpret_cast", "requires", "return", "short", "signed", "sizeof", "static",
+            "static_assert", "static_cast", "struct", "switch", "template", "this", "thread_local", "throw", "true",
+            "try", "typedef", "typeid", "typename", "union", "unsigned", "using", "virtual", "void", "volatile",
+            "wchar_t", "while", "__attribute__", "__declspec", "__int128"
+        };
+        return keywords.contains(word);
+    }
+
+    // keywords that can be a part of a type name as written
+    static bool isTypeKeyword(std::string_view word) {
+        static const std::set<std::string_view> words = {
+            "bool", "char", "char8_t", "char16_t", "char32_t", "double", "float", "int", "long", "short",
+            "signed", "unsigned", "void", "wchar_t", "typename", "struct", "class", "union", "enum"
+        };
+        return words.contains(word);
+    }
+
+    long getLineNumber(long offset) {
+        return lines.lineOf(offset);
+    }
+
+    std::string qualifiedName(const std::string& name, bool namespacesOnly) {
+        std::string result;
+        for (const auto& scope : scopes) {
+            if (scope.kind == Scope::Transparent) continue;
+            if (namespacesOnly && scope.kind == Scope::Record) continue;
+            result += scope.name + "::";
+        }
+        return result + name;
+    }
+
+    [[nodiscard]] bool inRecord() const {
+        for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
+            if (it->kind != Scope::Transparent) return it->kind == Scope::Record;
+        }
+        return false;
+    }
+
+    [[nodiscard]] bool hasMacro(size_t from, size_t to) const {
+        for (size_t i = from; i < to; i++) {
+            if (tokens[i].kind == Token::Identifier && macros.contains(std::string(tokens[i].text))) return true;
+        }
+        return false;
+    }
+
+    // index after the bracket closing the one at `i`, or 0 if it's not closed
+    [[nodiscard]] size_t skipBrackets(size_t i) const {
+        std::vector<char> stack;
+        for (; i < tokens.size(); i++) {
+            auto text = tokens[i].text;
+            if (tokens[i].kind != Token::Punct || text.size() != 1) continue;
+            char c = text[0];
+            if (c == '(' || c == '[' || c == '{') {
+                stack.push_back(c == '(' ? ')' : c == '[' ? ']' : '}');
+            } else if (c == ')' || c == ']' || c == '}') {
+                if (stack.empty() || stack.back() != c) return 0;
+                stack.pop_back();
+                if (stack.empty()) return i + 1;
+            }
+        }
+        return 0;
+    }
+
+    // index after the `>` closing template arguments that start with `<` at `i`, or 0
+    [[nodiscard]] size_t skipAngles(size_t i) const {
+        long depth = 0;
+        while (i < tokens.size()) {
+            auto text = tokens[i].text;
+            if (text == "(" || text == "[" || text == "{") {
+                i = skipBrackets(i);
+                if (i == 0) return 0;
+                continue;
+            }
+            if (text == "<") depth++;
+            else if (text == ">") depth--;
+            else if (text == ">>") depth -= 2;
+            else if (text == ";" || text == ")" || text == "]" || text == "}" || text == ">>=" || text == ">=") return 0;
+            i++;
+            if (depth == 0) return i;
+            if (depth < 0) return 0;
+        }
+        return 0;
+    }
+
+    bool parseScope(size_t& i) {
+        while (i < tokens.size() && !is(i, "}")) {
+            if (!parseDeclaration(i)) return false;
+        }
+        return true;
+    }
+
+    bool parseBlock(size_t& i, const Scope& scope) {
+        if (!is(i, "{")) return false;
+        i++;
+        scopes.push_back(scope);
+        if (!parseScope(i) || !is(i, "}")) return false;
+        scopes.pop_back();
+        i++;
+        return true;
+    }
+
+    bool parseDeclaration(size_t& i) {
+        auto first = tokens[i].text;
+        if (first == ";") {
+            i++;
+            return true;
+        }
+        if ((first == "public" || first == "private" || first == "protected") && is(i + 1, ":")) {
+            i += 2;
+            return true;
+        }
+        if (first == "namespace") {
+            return parseNamespace(i);
+        }
+        if (first == "extern" && i + 1 < tokens.size() && tokens[i + 1].kind == Token::String) {
+            if (!is(i + 2, "{")) return false;
+            i += 2;
+            return parseBlock(i, { Scope::Transparent, "" });
+        }
+        if (first == "extern" && is(i + 1, "template")) {
+            // explicit instantiation, nothing to extract
+            return skipStatement(i);
+        }
+        if (first == "using" || first == "typedef" || first == "static_assert" || first == "concept") {
+            return skipStatement(i);
+        }
+        if (first == "enum") {
+            return parseEnum(i);
+        }
+        if (first == "class" || first == "struct" || first == "union") {
+            // definition, unless it's `struct X;` or `struct X x...`
+            for (size_t j = i + 1; j < tokens.size(); j++) {
+                auto text = tokens[j].text;
+                if (text == "{") return parseRecord(i);
+                if (text == ";" || text == "(" || text == "=" || text == "<" || text == "*" || text == "&") break;
+            }
+        }
+
+        size_t head = i;
+        std::optional<std::pair<size_t, size_t>> templateHeader;
+        if (first == "template") {
+            if (!is(i + 1, "<")) {
+                // explicit instantiation
+                return skipStatement(i);
+            }
+            auto end = skipAngles(i + 1);
+            // specializations and templates of templates have their own rules
+            if (end == 0 || end == i + 3 || is(end, "template")) return false;
+            templateHeader = { i, end };
+            head = end;
+            if (is(head, "class") || is(head, "struct") || is(head, "union") || is(head, "using") || is(head, "concept")) {
+                // class templates: their methods aren't extracted the way they should be
+                for (size_t j = head; j < tokens.size(); j++) {
+                    if (is(j, "{")) return false;
+                    if (is(j, ";")) break;
+                }
+                return skipStatement(i);
+            }
+        }
+
+        // until `;` or a function body
+        bool initializer = false;
+        for (size_t j = head; j < tokens.size();) {
+            auto text = tokens[j].text;
+            if (tokens[j].kind == Token::Punct) {
+                if (text == ";") {
+                    if (templateHeader) {
+                        // declaration of a function template or a variable template
+                        if (initializer) return false;
+                        i = j + 1;
+                        return true;
+                    }
+                    bool ok = parseStatement(head, j);
+                    i = j + 1;
+                    return ok;
+                }
+                if (text == "}") return false;
+                if (text == "=") initializer = true;
+                if (text == "{" && !initializer) {
+                    auto end = skipBrackets(j);
+                    if (end == 0) return false;
+                    bool ok = parseFunction(head, j, end, templateHeader);
+                    i = end;
+                    return ok;
+                }
+                if (text == "(" || text == "[" || text == "{") {
+                    j = skipBrackets(j);
+                    if (j == 0) return false;
+                    continue;
+                }
+            }
+            if (text == "operator") {
+                // `operator=` isn't an initializer
+                j += is(j + 1, "(") || is(j + 1, "[") ? 3 : 2;
+                continue;
+            }
+            j++;
+        }
+        return false;
+    }
+
+    bool skipStatement(size_t& i) {
+        while (i < tokens.size() && !is(i, ";")) {
+            if (is(i, "(") || is(i, "[") || is(i, "{")) {
+                i = skipBrackets(i);
+                if (i == 0) return false;
+                continue;
+            }
+            if (is(i, "}")) return false;
+            i++;
+        }
+        if (i == tokens.size()) return false;
+        i++;
+        return true;
+    }
+
+    bool parseNamespace(size_t& i) {
+        size_t j = i + 1;
+        std::vector<std::string> names;
+        while (isIdentifier(j) && !isKeyword(tokens[j].text)) {
+            names.emplace_back(tokens[j].text);
+            j++;
+            if (!is(j, "::")) break;
+            j++;
+        }
+        if (is(j, "=")) {
+            // alias
+            i = j;
+            return skipStatement(i);
+        }
+        // anonymous and attributed namespaces are named differently by clang
+        if (names.empty() || !is(j, "{") || hasMacro(i, j)) return false;
+
+        i = j + 1;
+        for (const auto& name : names) {
+            scopes.push_back({ Scope::Namespace, name });
+        }
+        if (!parseScope(i) || !is(i, "}")) return false;
+        for (size_t k = 0; k < names.size(); k++) {
+            scopes.pop_back();
+        }
+        i++;
+        return true;
+    }
+
+    bool parseEnum(size_t& i) {
+        size_t j = i;
+        while (j < tokens.size() && !is(j, "{") && !is(j, ";")) {
+            if (is(j, "(") || is(j, "}")) return false;
+            j++;
+        }
+        if (is(j, ";")) {
+            i = j + 1;
+            return true;
+        }
+        j = skipBrackets(j);
+        if (j == 0 || !is(j, ";")) return false;
+        i = j + 1;
+        return true;
+    }
+
+    bool parseRecord(size_t& i) {
+        size_t j = i + 1;
+        if (!isIdentifier(j) || isKeyword(tokens[j].text)) return false;
+        std::string name(tokens[j].text);
+        j++;
+        if (is(j, "final")) j++;
+        if (is(j, ":")) {
+            while (j < tokens.size() && !is(j, "{")) {
+                if (is(j, ";") || is(j, "(")) return false;
+                j++;
+            }
+        }
+        if (!is(j, "{") || hasMacro(i, j)) return false;
+
+        i = j;
+        if (!parseBlock(i, { Scope::Record, name })) return false;
+        // variables of the class type right away aren't supported
+        if (!is(i, ";")) return false;
+        i++;
+        return true;
+    }
+
+    // Return type, name, parameters and qualifiers of a function defined with body at `brace`
+    bool parseFunction(size_t head, size_t brace, size_t end, const std::optional<std::pair<size_t, size_t>>& templateHeader) {
+        if (hasMacro(head, brace)) return false;
+
+        size_t j = head;
+        bool isFriend = false, stays = false;
+        while (j < brace) {
+            auto text = tokens[j].text;
+            if (text == "inline" || text == "constexpr" || text == "consteval") {
+                stays = true;
+            } else if (text == "friend") {
+                isFriend = true;
+            } else if (text != "static" && text != "virtual" && text != "explicit") {
+                break;
+            }
+            j++;
+        }
+
+        // clang also extracts local variables of functions that are not members, so those are left to it
+        if (isFriend || !inRecord()) {
+            for (size_t k = brace + 1; k + 1 < end; k++) {
+                if (is(k, "=")) return false;
+                bool declaration = isIdentifier(k) && isIdentifier(k + 1) && (is(k + 2, "(") || is(k + 2, "{"));
+                if (declaration && !(isKeyword(tokens[k].text) && !isTypeKeyword(tokens[k].text))) return false;
+            }
+        }
+        if (stays) {
+            // inline and constexpr functions stay in the header
+            return true;
+        }
+        long beginOffset = tokens[head].start;
+        if (is(head, "[") && is(head + 1, "[")) {
+            // attributes are not a part of the declaration begin
+            auto attributesEnd = skipBrackets(head);
+            if (attributesEnd == 0) return false;
+            j = attributesEnd;
+            while (j < brace && (is(j, "static") || is(j, "virtual") || is(j, "explicit"))) j++;
+            if (j >= brace) return false;
+            beginOffset = tokens[attributesEnd].start;
+        }
+
+        // parameters start at the first `(` outside of template arguments, after the name
+        size_t nameStart = 0, paramsStart = 0;
+        for (size_t k = j; k < brace; k++) {
+            auto text = tokens[k].text;
+            if (text == "operator") {
+                nameStart = k;
+                paramsStart = k + 1;
+                if (is(k + 1, "(") && is(k + 2, ")")) paramsStart = k + 3;
+                else if (is(k + 1, "[") && is(k + 2, "]")) paramsStart = k + 3;
+                else if (is(k + 1, "new") || is(k + 1, "delete")) paramsStart = is(k + 2, "[") && is(k + 3, "]") ? k + 4 : k + 2;
+                else if (k + 1 < brace) paramsStart = k + 2;
+                if (!is(paramsStart, "(")) return false;
+                break;
+            }
+            if (text == "<") {
+                k = skipAngles(k);
+                if (k == 0) return false;
+                k--;
+                continue;
+            }
+            if (text == "(") {
+                paramsStart = k;
+                break;
+            }
+            if (tokens[k].kind == Token::Punct && text != "::" && text != "*" && text != "&" && text != "&&" && text != "~" && text != ">") {
+                return false;
+            }
+        }
+        if (paramsStart == 0) return false;
+
+        std::string name;
+        if (nameStart != 0) {
+            for (size_t k = nameStart + 1; k < paramsStart; k++) {
+                name += tokens[k].text;
+            }
+            if (name.empty()) return false;
+            if (isIdentifier(nameStart + 1)) {
+                if (paramsStart != nameStart + 2) return false;
+                // `new`/`delete` or a conversion
+                name = " " + name;
+            }
+            name = "operator" + name;
+            // qualified operator names
+            while (nameStart >= j + 2 && is(nameStart - 1, "::") && isIdentifier(nameStart - 2)) {
+                nameStart -= 2;
+                name = std::string(tokens[nameStart].text) + "::" + name;
+            }
+        } else {
+            nameStart = paramsStart - 1;
+            if (!isIdentifier(nameStart) || isKeyword(tokens[nameStart].text)) return false;
+            name = tokens[nameStart].text;
+            if (nameStart > j && is(nameStart - 1, "~")) {
+                nameStart--;
+                name = "~" + name;
+            }
+            while (nameStart >= j + 2 && is(nameStart - 1, "::") && isIdentifier(nameStart - 2)) {
+                nameStart -= 2;
+                name = std::string(tokens[nameStart].text) + "::" + name;
+            }
+        }
+        if (nameStart > j && is(nameStart - 1, "::")) return false;
+
+        // return type as clang sees it: without top level qualifiers, which are added back only when it's const
+        std::string returnType;
+        bool constReturn = false;
+        size_t typeStart = j;
+        if (is(typeStart, "const")) {
+            constReturn = true;
+            typeStart++;
+        }
+        bool indirect = false;
+        for (size_t k = typeStart; k < nameStart; k++) {
+            auto text = tokens[k].text;
+            if (tokens[k].kind == Token::Identifier) {
+                if (text == "const" || text == "volatile" || text == "decltype" || (isKeyword(text) && !isTypeKeyword(text) && text != "auto")) return false;
+                if (indirect) return false;
+            } else if (text == "<") {
+                k = skipAngles(k);
+                if (k == 0) return false;
+                k--;
+            } else if (text == "*" || text == "&" || text == "&&") {
+                indirect = true;
+            } else if (text != "::") {
+                return false;
+            }
+        }
+        if (constReturn && (indirect || typeStart == nameStart)) return false;
+        if (typeStart < nameStart) {
+            returnType = code.substr(tokens[typeStart].start, tokens[nameStart - 1].end() - tokens[typeStart].start);
+        } else {
+            // only constructors, destructors and conversions have no return type
+            auto unqualified = name.substr(name.rfind("::") == std::string::npos ? 0 : name.rfind("::") + 2);
+            bool special = unqualified.starts_with("operator ") || unqualified.starts_with("~") || (inRecord() && unqualified == scopes.back().name);
+            if (!special || unqualified.starts_with("operator new") || unqualified.starts_with("operator delete")) return false;
+        }
+        if (name.find("::") != std::string::npos && (isFriend || templateHeader)) return false;
+
+        size_t paramsEnd = skipBrackets(paramsStart);
+        if (paramsEnd == 0 || paramsEnd > brace) return false;
+
+        bool isConst = false;
+        for (size_t k = paramsEnd; k < brace; k++) {
+            auto text = tokens[k].text;
+            if (text == "const") isConst = true;
+            else if (text != "override" && text != "final") return false;
+        }
+
+        // parameters: from the beginning until the name if there is a default value, or the end otherwise
+        std::vector<std::pair<long, long>> params;
+        size_t closing = paramsEnd - 1;
+        size_t paramStart = paramsStart + 1, defaultAt = 0;
+        long angles = 0;
+        for (size_t k = paramStart;;) {
+            bool last = k == closing;
+            if (!last) {
+                auto text = tokens[k].text;
+                if (text == "[" && is(k + 1, "[")) return false;
+                if (text == "(" || text == "[" || text == "{") {
+                    k = skipBrackets(k);
+                    continue;
+                }
+                if (text == "...") return false;
+                if (defaultAt) {
+                    // commas of template arguments can't be told apart in expressions
+                    if (text == "<") return false;
+                } else if (text == "<") {
+                    angles++;
+                } else if (text == ">") {
+                    angles--;
+                } else if (text == ">>") {
+                    angles -= 2;
+                } else if (text == "=" && angles == 0) {
+                    defaultAt = k;
+                }
+                if (text != "," || angles != 0) {
+                    k++;
+                    continue;
+                }
+            }
+            if (k == paramStart) {
+                if (last && k == paramsStart + 1) break;
+                return false;
+            }
+            if (defaultAt) {
+                if (defaultAt == paramStart || !isIdentifier(defaultAt - 1) || isKeyword(tokens[defaultAt - 1].text)) return false;
+                params.emplace_back(tokens[paramStart].start, tokens[defaultAt - 1].end());
+            } else {
+                params.emplace_back(tokens[paramStart].start, tokens[k - 1].end());
+            }
+            if (last) break;
+            paramStart = ++k;
+            defaultAt = 0;
+            angles = 0;
+        }
+        if (params.size() == 1 && paramsStart + 3 == paramsEnd && is(paramsStart + 1, "void")) {
+            params.clear();
+        }
+
+        auto& s = extraction;
+        auto ifdef = ifdefs.at(beginOffset);
+        if (ifdef) {
+            s.text(*ifdef + "\n");
+        }
+        s.line(beginOffset);
+        if (templateHeader) {
+            s.text(code.substr(tokens[templateHeader->first].start, tokens[templateHeader->second - 1].end() - tokens[templateHeader->first].start));
+            s.text("\n");
+        }
+        if (constReturn) {
+            s.text("const ");
+        }
+        s.text(returnType);
+        s.text(" ");
+        s.text(qualifiedName(name, isFriend));
+        s.text("(");
+        bool first = true, addedLines = false;
+        for (const auto &[start, end] : params) {
+            if (!first) {
+                s.text(", ");
+            }
+            first = false;
+            if (getLineNumber(start) != getLineNumber(beginOffset)) {
+                s.line(start);
+                s.text("\t", Fragment::LinesText);
+                addedLines = true;
+            }
+            s.text(code.substr(start, end - start));
+        }
+        if (addedLines) {
+            s.text("\n", Fragment::LinesText);
+        }
+        s.text(") ");
+        if (isConst) {
+            s.text("const ");
+        }
+        long bodyStart = tokens[brace].start, bodyEnd = tokens[end - 1].end();
+        s.original(bodyStart, code.substr(bodyStart, bodyEnd - bodyStart));
+        s.text(";\n");
+        if (ifdef) {
+            s.text("#endif\n");
+        }
+
+        long idx = bodyStart - 1;
+        while (idx >= 0 && is_whitespace(code[idx])) { idx--; }
+        replacements.emplace_back(std::pair{ idx + 1, bodyEnd }, bodyEnd < static_cast<long>(code.size()) && code[bodyEnd] == ';' ? "" : ";");
+        return true;
+    }
+
+    // `T x(a)` initializes a variable that clang extracts, so parentheses must be surely parameters of a function:
+    // empty, a type keyword, or type and name without anything that could only be in an expression
+    [[nodiscard]] bool onlyParameterLists(size_t head, size_t end) const {
+        for (size_t k = head; k < end; k++) {
+            if (is(k, "operator")) {
+                k += is(k + 1, "(") || is(k + 1, "[") ? 2 : 1;
+                continue;
+            }
+            if (!is(k, "(")) continue;
+
+            auto close = skipBrackets(k);
+            size_t paramStart = k + 1;
+            bool defaultValue = false;
+            for (size_t p = k + 1; p < close; p++) {
+                bool last = p == close - 1;
+                if (!last && (is(p, "(") || is(p, "[") || is(p, "{"))) {
+                    p = skipBrackets(p) - 1;
+                    continue;
+                }
+                if (!last && !is(p, ",")) {
+                    if (is(p, "=")) defaultValue = true;
+                    if (defaultValue) continue;
+                    auto text = tokens[p].text;
+                    if (tokens[p].kind == Token::Number || tokens[p].kind == Token::String) return false;
+                    if (tokens[p].kind == Token::Punct && text != "::" && text != "*" && text != "&" && text != "&&" && text != "<" && text != ">" && text != ">>" && text != "...") return false;
+                    continue;
+                }
+                size_t count = p - paramStart;
+                if (count == 0 && !(last && paramStart == k + 1)) return false;
+                if (count == 1 && !isTypeKeyword(tokens[paramStart].text)) return false;
+                paramStart = p + 1;
+                defaultValue = false;
+            }
+            k = close - 1;
+        }
+        return true;
+    }
+
+    // Declaration ending with `;` at `end`: only variables with initializers are extracted
+    bool parseStatement(size_t head, size_t end) {
+        size_t firstEq = 0;
+        bool parens = false;
+        for (size_t k = head; k < end; k++) {
+            auto text = tokens[k].text;
+            if (text == "operator") {
+                k++;
+                continue;
+            }
+            if (text == "(" || text == "[" || text == "{") {
+                parens = parens || text == "(";
+                k = skipBrackets(k) - 1;
+                continue;
+            }
+            if (text == "=") {
+                firstEq = k;
+                break;
+            }
+        }
+        auto first = tokens[head].text;
+        if (first == "friend" || first == "using" || first == "typedef") return true;
+        if (!firstEq) {
+            return !parens || inRecord() || (!hasMacro(head, end) && onlyParameterLists(head, end));
+        }
+        if (parens) {
+            // `= default`, `= delete` and pure virtual functions
+            return firstEq + 2 == end && (is(firstEq + 1, "default") || is(firstEq + 1, "delete") || is(firstEq + 1, "0"));
+        }
+        if (hasMacro(head, firstEq)) return false;
+
+        bool isStatic = false;
+        size_t j = head;
+        while (j < firstEq && tokens[j].kind == Token::Identifier) {
+            auto text = tokens[j].text;
+            if (text == "constexpr") return true;
+            if (text == "static") {
+                isStatic = true;
+            } else if (text == "mutable") {
+                return inRecord();
+            } else if (text == "const" || text == "volatile" || text == "inline" || text == "extern" || text == "thread_local" || text == "constinit" || text == "auto" || text == "decltype" || text == "register") {
+                return false;
+            } else {
+                break;
+            }
+            j++;
+        }
+        bool record = inRecord();
+        // non-static members keep their initializers
+        if (record && !isStatic) return true;
+        // `static` at namespace level would become `extern static`
+        if (!record && isStatic) return false;
+
+        // type, then pointer or reference declarators, then the name right before `=` or `,`
+        size_t declaratorEnd = j;
+        for (size_t k = j; k < end; k++) {
+            auto text = tokens[k].text;
+            if (text == "<") {
+                k = skipAngles(k);
+                if (k == 0) return false;
+                k--;
+                continue;
+            }
+            if (text == "=" || text == ",") {
+                declaratorEnd = k;
+                break;
+            }
+            if (tokens[k].kind == Token::Identifier) {
+                if (text == "const" || text == "volatile" || text == "auto" || text == "decltype" || text == "static" || (isKeyword(text) && !isTypeKeyword(text))) return false;
+            } else if (text != "::" && text != "*" && text != "&" && text != "&&") {
+                return false;
+            }
+        }
+        size_t nameIndex = declaratorEnd - 1;
+        if (declaratorEnd <= j + 1 || !isIdentifier(nameIndex) || isKeyword(tokens[nameIndex].text) || is(nameIndex - 1, "::")) return false;
+        size_t typeEnd = nameIndex;
+        bool indirect = false;
+        while (typeEnd > j && (is(typeEnd - 1, "*") || is(typeEnd - 1, "&") || is(typeEnd - 1, "&&"))) {
+            typeEnd--;
+            indirect = true;
+        }
+        if (typeEnd == j) return false;
+        auto type = code.substr(tokens[j].start, tokens[nameIndex - 1].end() - tokens[j].start);
+
+        // all declarators: `name [= init]` separated by commas
+        struct Declarator {
+            size_t name;
+            size_t initStart;
+            size_t initEnd;
+        };
+        std::vector<Declarator> declarators;
+        size_t k = nameIndex;
+        while (true) {
+            if (!isIdentifier(k) || isKeyword(tokens[k].text)) return false;
+            Declarator declarator = { k, 0, 0 };
+            k++;
+            if (is(k, "=")) {
+                declarator.initStart = ++k;
+                bool angles = false;
+                while (k < end && !is(k, ",")) {
+                    if (is(k, "(") || is(k, "[") || is(k, "{")) {
+                        k = skipBrackets(k);
+                        if (k == 0 || k > end) return false;
+                        continue;
+                    }
+                    angles = angles || is(k, "<");
+                    k++;
+                }
+                // a comma after `<` may be in template arguments as well
+                if (k == declarator.initStart || (angles && k < end)) return false;
+                declarator.initEnd = k;
+            }
+            if (declarator.initStart) declarators.push_back(declarator);
+            if (k == end) break;
+            if (!is(k, ",")) return false;
+            k++;
+        }
+        if (declarators.size() > 1 && (indirect || !record)) return false;
+
+        long declStart = tokens[head].start;
+        for (const auto &[name, initStart, initEnd] : declarators) {
+            if (!record) {
+                replacements.emplace_back(std::pair{ declStart, declStart }, "extern ");
+            }
+            replacements.emplace_back(std::pair{ tokens[name].end(), tokens[initEnd - 1].end() }, "");
+
+            auto& s = extraction;
+            auto ifdef = ifdefs.at(declStart);
+            if (ifdef) {
+                s.text(*ifdef + "\n");
+            }
+            s.line(declStart);
+            s.text(type);
+            s.text(" " + qualifiedName(std::string(tokens[name].text), false));
+            s.text(" = ");
+            long initOffset = tokens[initStart].start;
+            s.original(initOffset, code.substr(initOffset, tokens[initEnd - 1].end() - initOffset));
+            s.text(";\n");
+            if (ifdef) {
+                s.text("#endif\n");
+            }
+        }
+        return true;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef LINEINDEX_H
+#define LINEINDEX_H
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Offsets of all `\n` in a file, found once, for line numbers of offsets
+class LineIndex {
+public:
+    explicit LineIndex(std::string_view code) {
+        newLines.reserve(code.size() / 32);
+        const char* data = code.data();
+        size_t size = code.size(), i = 0;
+#if defined(__SSE2__)
+        const __m128i newLine = _mm_set1_epi8('\n');
+        for (; i + 16 <= size; i += 16) {
+            auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newLine));
+            while (mask) {
+                newLines.push_back(static_cast<long>(i + __builtin_ctz(mask)));
+                mask &= mask - 1;
+            }
+        }
+#endif
+        while (i < size) {
+            auto found = static_cast<const char*>(std::memchr(data + i, '\n', size - i));
+            if (!found) break;
+            i = found - data;
+            newLines.push_back(static_cast<long>(i++));
+        }
+    }
+
+    // 1-based line of `offset`; a `\n` belongs to the line it ends
+    [[nodiscard]] long lineOf(long offset) const {
+        return 1 + (std::lower_bound(newLines.begin(), newLines.end(), offset) - newLines.begin());
+    }
+
+    // Same, starting from where the previous lookup ended in `hint`: amortized O(1) for offsets in increasing order
+    [[nodiscard]] long lineOf(long offset, size_t& hint) const {
+        if (hint > newLines.size() || (hint > 0 && newLines[hint - 1] >= offset)) {
+            hint = std::lower_bound(newLines.begin(), newLines.end(), offset) - newLines.begin();
+            return 1 + static_cast<long>(hint);
+        }
+        for (int steps = 0; hint < newLines.size() && newLines[hint] < offset; steps++) {
+            if (steps == 8) {
+                // far ahead, not worth walking
+                hint = std::lower_bound(newLines.begin() + static_cast<long>(hint), newLines.end(), offset) - newLines.begin();
+                break;
+            }
+            hint++;
+        }
+        return 1 + static_cast<long>(hint);
+    }
+
+    [[nodiscard]] const std::vector<long>& offsets() const {
+        return newLines;
+    }
+
+private:
+    std::vector<long> newLines;
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef PRECOMPILEDHEADER_H
+#define PRECOMPILEDHEADER_H
+
+#include "IfDefParser.hpp"
+#include "IncludePruner.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Includes a file makes outside of any #if (other than its include guard), as written
+struct FileIncludes {
+    std::vector<std::string> angled;
+    std::vector<std::string> quoted;
+};
+
+inline FileIncludes unconditionalIncludes(std::string_view code) {
+    auto [ifdefs, cleared] = parseIfDefs(code);
+    FileIncludes includes;
+    for (auto& include : headless::includeDirectives(ifdefs, cleared)) {
+        if (!include.unconditional || include.header.empty()) continue;
+        (include.angled ? includes.angled : includes.quoted).push_back(std::move(include.header));
+    }
+    return includes;
+}
+
+struct PchCandidate {
+    std::string header;  // as written between `<>`
+    size_t units;        // translation units that include it, directly or through project headers
+    double cost_ms;      // to parse it on its own
+};
+
+// A header is worth precompiling when enough translation units include it and it takes a while to parse;
+// cheap or rarely included headers only make the PCH slower to rebuild and every unit parse more than it needs
+constexpr size_t PCH_MIN_UNITS = 2;
+constexpr double PCH_MIN_SHARE = 0.2;
+constexpr double PCH_MIN_COST_MS = 5;
+
+// Whether a header included by `included_by` of `units` translation units is included often enough, whatever it costs
+inline bool includedOftenEnough(size_t included_by, size_t units) {
+    return included_by >= PCH_MIN_UNITS && static_cast<double>(included_by) >= PCH_MIN_SHARE * static_cast<double>(units);
+}
+
+// Candidates worth precompiling in `units` translation units, sorted by name so the PCH only changes when the choice does
+inline std::vector<PchCandidate> choosePch(std::vector<PchCandidate> candidates, size_t units) {
+    std::erase_if(candidates, [&](const PchCandidate& candidate) {
+        return !includedOftenEnough(candidate.units, units) || candidate.cost_ms < PCH_MIN_COST_MS;
+    });
+    std::sort(candidates.begin(), candidates.end(), [](const auto& a, const auto& b) { return a.header < b.header; });
+    return candidates;
+}
+
+inline std::string writePch(const std::vector<PchCandidate>& chosen) {
+    std::stringstream s;
+    s << "// Automatically generated with `headless`\n";
+    s << "// Headers that most sources include and that take longest to parse, see `pch.cmake`\n";
+    s << "#ifdef __cplusplus\n";
+    for (const auto& candidate : chosen) {
+        s << "#include <" << candidate.header << ">\n";
+    }
+    s << "#endif\n";
+    return s.str();
+}
+
+// `headless_precompile_headers(target)` in CMake after `include(gsrc/pch.cmake)`
+inline std::string writePchCmake() {
+    return "# Automatically generated with `headless`\n"
+           "set(HEADLESS_PCH \"${CMAKE_CURRENT_LIST_DIR}/headless_pch.hpp\")\n"
+           "macro(headless_precompile_headers target)\n"
+           "\ttarget_precompile_headers(${target} PRIVATE \"${HEADLESS_PCH}\")\n"
+           "endmacro()\n";
+}
+
+#endif
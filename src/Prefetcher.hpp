@@ -0,0 +1,207 @@
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+
+#ifdef __linux__
+
+#include "IoRing.hpp"
+#include "utils.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Reads files on a thread of its own with io_uring, ahead of the workers that need them: opens a batch of files
+// with one syscall, reads all of them with another, and closes them with a third. Small files are read into memory,
+// larger ones (that get mapped anyway) are only read into the page cache. At most `window` bytes wait to be taken
+class Prefetcher {
+public:
+    struct File {
+        std::string path;
+        uint64_t size;
+    };
+
+    // `files` go in the order they are going to be needed
+    Prefetcher(std::vector<File> files, size_t window = 64 * 1024 * 1024) : files(std::move(files)), window(window) {
+        for (size_t i = 0; i < this->files.size(); i++) {
+            slots[this->files[i].path].index = i;
+        }
+        thread = std::thread([this] { run(); });
+    }
+
+    ~Prefetcher() {
+        {
+            std::lock_guard lock(mutex);
+            stopped = true;
+        }
+        changed.notify_all();
+        thread.join();
+    }
+
+    Prefetcher(const Prefetcher&) = delete;
+    Prefetcher& operator=(const Prefetcher&) = delete;
+
+    // Content of `path` if it was read ahead, waiting for it when it's being read right now.
+    // Nothing for files that weren't reached yet (they are skipped from then on) and files that are mapped instead
+    std::optional<std::string> take(const std::string& path) {
+        std::unique_lock lock(mutex);
+        auto it = slots.find(path);
+        if (it == slots.end()) return std::nullopt;
+        auto& slot = it->second;
+        if (slot.status == Status::Pending) {
+            slot.status = Status::Taken;
+            return std::nullopt;
+        }
+        changed.wait(lock, [&] { return slot.status != Status::Reading; });
+        if (slot.status != Status::Read) return std::nullopt;
+        slot.status = Status::Taken;
+        buffered -= slot.content.size();
+        changed.notify_all();
+        return std::move(slot.content);
+    }
+
+    // Drops whatever was read for `path` and not taken
+    void release(const std::string& path) {
+        std::lock_guard lock(mutex);
+        auto it = slots.find(path);
+        if (it == slots.end() || it->second.status == Status::Reading) return;
+        if (it->second.status == Status::Read) {
+            buffered -= it->second.content.size();
+            it->second.content = std::string();
+            changed.notify_all();
+        }
+        it->second.status = Status::Taken;
+    }
+
+    // False when io_uring isn't available, then nothing is read ahead
+    [[nodiscard]] bool active() {
+        std::unique_lock lock(mutex);
+        changed.wait(lock, [&] { return started; });
+        return ring_valid;
+    }
+
+private:
+    enum class Status { Pending, Reading, Read, Taken };
+
+    struct Slot {
+        size_t index = 0;
+        Status status = Status::Pending;
+        std::string content;
+    };
+
+    // the ring has room for one operation of each file in a batch
+    static constexpr unsigned BATCH = 64;
+
+    std::vector<File> files;
+    size_t window;
+    std::unordered_map<std::string, Slot> slots;
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t buffered = 0;
+    bool stopped = false, started = false, ring_valid = false;
+    std::thread thread;
+
+    void run() {
+        IoRing ring(BATCH);
+        {
+            std::lock_guard lock(mutex);
+            started = true;
+            ring_valid = ring.valid();
+        }
+        changed.notify_all();
+        if (!ring.valid()) return;
+
+        size_t next = 0;
+        while (true) {
+            std::vector<Slot*> batch;
+            {
+                std::unique_lock lock(mutex);
+                // waits for the workers to take what was read, unless nothing is waiting at all
+                changed.wait(lock, [&] { return stopped || buffered < window; });
+                if (stopped) return;
+                size_t bytes = buffered;
+                for (; next < files.size() && batch.size() < BATCH; next++) {
+                    auto& slot = slots[files[next].path];
+                    if (slot.status != Status::Pending) continue;
+                    auto size = memory_size(files[next]);
+                    if (!batch.empty() && bytes + size > window) break;
+                    bytes += size;
+                    slot.status = Status::Reading;
+                    batch.push_back(&slot);
+                }
+            }
+            if (batch.empty()) return;
+            read(ring, batch);
+        }
+    }
+
+    [[nodiscard]] static uint64_t memory_size(const File& file) {
+        return file.size < MappedFile::MIN_MAPPED_SIZE ? file.size : 0;
+    }
+
+    void read(IoRing& ring, const std::vector<Slot*>& batch) {
+        std::vector<int> fds(batch.size(), -1);
+        std::vector<int> results(batch.size(), -1);
+        auto complete = [&](unsigned count, std::vector<int>& out) {
+            if (!ring.submit(count)) return;
+            while (auto completion = ring.reap()) {
+                out[completion->first] = completion->second;
+            }
+        };
+
+        for (size_t i = 0; i < batch.size(); i++) {
+            ring.open(files[batch[i]->index].path.c_str(), i);
+        }
+        complete(static_cast<unsigned>(batch.size()), fds);
+
+        // one more byte than expected, so a file that grew since it was listed is noticed and read the usual way
+        std::vector<std::string> contents(batch.size());
+        unsigned reads = 0;
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (fds[i] < 0) continue;
+            const auto& file = files[batch[i]->index];
+            if (memory_size(file) || file.size == 0) {
+                contents[i].resize(file.size + 1);
+                ring.read(fds[i], contents[i].data(), static_cast<unsigned>(file.size + 1), i);
+            } else {
+                ring.readahead(fds[i], i);
+            }
+            reads++;
+        }
+        complete(reads, results);
+
+        std::vector<int> closed(batch.size());
+        unsigned closes = 0;
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (fds[i] >= 0 && ring.close(fds[i], i)) closes++;
+        }
+        complete(closes, closed);
+
+        {
+            std::lock_guard lock(mutex);
+            for (size_t i = 0; i < batch.size(); i++) {
+                auto& slot = *batch[i];
+                const auto& file = files[slot.index];
+                bool inMemory = memory_size(file) || file.size == 0;
+                if (fds[i] >= 0 && inMemory && results[i] == static_cast<int>(file.size)) {
+                    contents[i].resize(file.size);
+                    slot.content = std::move(contents[i]);
+                    slot.status = Status::Read;
+                    buffered += file.size;
+                } else {
+                    // mapped by whoever takes it, or failed and read the usual way
+                    slot.status = Status::Taken;
+                }
+            }
+        }
+        changed.notify_all();
+    }
+};
+
+#endif
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include "EditList.hpp"
+#include "Extraction.hpp"
+#include "LineIndex.hpp"
+#include "utils.hpp"
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace headless {
+
+// With `--stable-lines`, the header follows the original file with #line only until the first extracted
+// definition and then switches to its own numbering, so editing function bodies doesn't change it
+struct StableHeaderLines {
+    std::string path;
+    long firstLine;
+};
+
+// Builds generated `.hpp` and `.cpp` from an `Extraction`, without clang
+class Renderer {
+public:
+    Renderer(
+        std::string_view originalHeaderCode,
+        const Extraction& extraction,
+        std::optional<std::string> pathForLines,
+        std::optional<StableHeaderLines> stableHeaderLines
+    ) :
+    originalHeaderCode(originalHeaderCode),
+    extraction(extraction),
+    pathForLines(std::move(pathForLines)),
+    stableHeaderLines(std::move(stableHeaderLines)),
+    edits(extraction.replacements, static_cast<long>(originalHeaderCode.size())),
+    lines(originalHeaderCode) {}
+
+    std::string getCppImplementations() {
+        std::string s;
+        appendCppImplementations(s);
+        return s;
+    }
+
+    void appendCppImplementations(std::string& s) {
+        size_t size = 0;
+        for (const auto& fragment : extraction.fragments) size += fragment.text.size();
+        s.reserve(s.size() + (pathForLines ? size * 2 : size));
+
+        for (const auto& fragment : extraction.fragments) {
+            switch (fragment.kind) {
+                case Fragment::Text:
+                    s += fragment.text;
+                    break;
+                case Fragment::LinesText:
+                    if (pathForLines) s += fragment.text;
+                    break;
+                case Fragment::Line:
+                    if (pathForLines) {
+                        s += '\n';
+                        pushLine(s, lines.lineOf(fragment.offset), pathForLines.value());
+                    }
+                    break;
+                case Fragment::Original:
+                    pushOriginal(s, fragment.text, fragment.offset);
+                    break;
+            }
+        }
+    }
+
+    void pushOriginal(std::string& s, const std::string& original, long startOffset) {
+        if (!pathForLines) {
+            s += original;
+            return;
+        }
+
+        long firstLineNumber = lines.lineOf(startOffset);
+        size_t hint = firstLineNumber - 1;
+        long index = 0, size = static_cast<long>(original.length());
+        while (index < size) {
+            auto nextLineIndex = original.find('\n', index);
+            long lineEnd = nextLineIndex == std::string::npos ? size : static_cast<long>(nextLineIndex);
+            long lineNumber = lines.lineOf(startOffset + index + 1, hint);
+            if (firstLineNumber != lineNumber) {
+                s += '\n';
+                pushLine(s, lineNumber, pathForLines.value());
+            }
+            s.append(original, index, lineEnd - index);
+            if (nextLineIndex == std::string::npos) break;
+            index = lineEnd + 1;
+        }
+    }
+
+    long getOriginalOffset(long modifiedOffset) {
+        return edits.originalOffset(modifiedOffset);
+    }
+
+    std::string getModifiedHeader() {
+        std::string sourceText = edits.apply(originalHeaderCode);
+        if (!pathForLines) {
+            return sourceText;
+        }
+
+        std::string s;
+        s.reserve(sourceText.size() * 2);
+        long size = static_cast<long>(sourceText.length());
+        long index = 0;
+        size_t hint = 0;
+
+        // in stable mode, everything after the first replacement is numbered by the generated header itself
+        long stableUntil = -1, newLines = 0;
+        if (stableHeaderLines) {
+            stableUntil = edits.empty() ? size : edits.sorted().front().modifiedStart;
+        }
+
+        while (index < size) {
+            auto nextLineIndex = sourceText.find('\n', index);
+            long lineEnd = nextLineIndex == std::string::npos ? size : static_cast<long>(nextLineIndex);
+            std::string_view line(sourceText.data() + index, lineEnd - index);
+            if (stableHeaderLines && index > stableUntil) {
+                if (index > 0) {
+                    s += '\n';
+                    newLines++;
+                }
+                if (stableUntil >= 0) {
+                    pushLine(s, stableHeaderLines->firstLine + newLines + 1, stableHeaderLines->path);
+                    stableUntil = -1;
+                }
+                s += line;
+            } else {
+                // every line that isn't blank starts on a line of its own with its #line, blank ones are appended as they are
+                if (line.find_first_not_of(ws) != std::string_view::npos) {
+                    if (index > 0) {
+                        s += '\n';
+                        newLines++;
+                    }
+                    pushLine(s, lines.lineOf(getOriginalOffset(index + 1), hint), pathForLines.value());
+                    newLines++;
+                }
+                s += line;
+            }
+            if (nextLineIndex == std::string::npos) break;
+            index = lineEnd + 1;
+        }
+        return s;
+    }
+
+private:
+    std::string_view originalHeaderCode;
+    const Extraction& extraction;
+    std::optional<std::string> pathForLines;
+    std::optional<StableHeaderLines> stableHeaderLines;
+    EditList edits;
+    LineIndex lines;
+
+    static void pushLine(std::string& s, long lineNumber, const std::string& path) {
+        s += "#line ";
+        s += std::to_string(lineNumber);
+        s += " \"";
+        s += path;
+        s += "\"\n";
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "utils.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Everything under a directory, listed once at the start of a sync so that decisions don't need a syscall each.
+// Every directory is read through its own descriptor and its entries are stat'ed relative to it,
+// which skips resolving the whole path again for every file. Names starting with `.headless` at the root are headless' own
+class Snapshot {
+public:
+    static Snapshot scan(const std::filesystem::path& root) {
+        Snapshot snapshot;
+        snapshot.scanned_ns = now_ns();
+        int fd = open(root.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd >= 0) {
+            struct stat st;
+            if (fstat(fd, &st) == 0) {
+                snapshot.entries[""] = { to_file_stat(st), true };
+            }
+            snapshot.scan_dir(fd, "");
+        }
+        return snapshot;
+    }
+
+    // When the scan started, everything in the snapshot is from after that
+    int64_t scanned_ns = 0;
+
+    // Paths are relative to the root
+    [[nodiscard]] bool contains(const std::filesystem::path& path) const {
+        return entries.contains(path.generic_string());
+    }
+
+    [[nodiscard]] bool is_dir(const std::filesystem::path& path) const {
+        auto it = entries.find(path.generic_string());
+        return it != entries.end() && it->second.is_dir;
+    }
+
+    [[nodiscard]] std::optional<FileStat> stat(const std::filesystem::path& path) const {
+        auto it = entries.find(path.generic_string());
+        if (it == entries.end()) return std::nullopt;
+        return it->second.stat;
+    }
+
+    // Same as `read_dir`: names in `dir` and whether they are directories, sorted
+    [[nodiscard]] const std::vector<std::pair<std::string, bool>>& children(const std::filesystem::path& dir) const {
+        static const std::vector<std::pair<std::string, bool>> none;
+        auto it = dirs.find(dir.generic_string());
+        return it == dirs.end() ? none : it->second;
+    }
+
+    // All directories with their stats, the root is ""
+    [[nodiscard]] std::map<std::string, FileStat> directories() const {
+        std::map<std::string, FileStat> result;
+        for (const auto &[path, entry] : entries) {
+            if (entry.is_dir) result.emplace_hint(result.end(), path, entry.stat);
+        }
+        return result;
+    }
+
+private:
+    struct Entry {
+        FileStat stat;
+        bool is_dir;
+    };
+
+    std::map<std::string, Entry> entries;
+    std::map<std::string, std::vector<std::pair<std::string, bool>>> dirs;
+
+    // Takes over `fd`
+    void scan_dir(int fd, const std::string& prefix) {
+        DIR* dir = fdopendir(fd);
+        if (!dir) {
+            close(fd);
+            return;
+        }
+        auto& children = dirs[prefix];
+        while (auto* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name == "." || name == ".." || (prefix.empty() && name.starts_with(".headless"))) continue;
+
+            // follows symlinks, same as `std::filesystem::status`
+            struct stat st;
+            if (fstatat(fd, name.c_str(), &st, 0) != 0) continue;
+            bool is_dir = S_ISDIR(st.st_mode);
+            auto path = prefix.empty() ? name : prefix + "/" + name;
+            entries[path] = { to_file_stat(st), is_dir };
+            children.emplace_back(name, is_dir);
+
+            if (is_dir) {
+                int sub = openat(fd, name.c_str(), O_RDONLY | O_DIRECTORY);
+                if (sub >= 0) scan_dir(sub, path);
+            }
+        }
+        closedir(dir);
+        std::sort(children.begin(), children.end());
+    }
+};
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include "Hash.hpp"
+#include "utils.hpp"
+
+#include <charconv>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifndef HEADLESS_VERSION
+#define HEADLESS_VERSION "dev"
+#endif
+
+// What `headless` knew about an input file the last time it was synced
+struct StateEntry {
+    uint64_t hash;
+    FileStat stat;
+};
+
+// Incremental state, kept in `<to>/.headless-state`:
+//
+//   headless-state <format> <options hash>
+//   from|to <size> <mtime ns> <inode> <directory path>
+//   ...
+//   <content hash> <size> <mtime ns> <inode> <path>
+//   ...
+//
+// Fields are separated by tabs, path goes last. Directories of both trees are there only
+// when their stats can be trusted to show any later change (see `settled`)
+class State {
+public:
+    static constexpr const char* FILE_NAME = ".headless-state";
+    static constexpr int FORMAT = 2;
+
+    uint64_t options_hash = 0;
+    std::map<std::string, StateEntry> entries;
+    std::map<std::string, FileStat> from_dirs;
+    std::map<std::string, FileStat> to_dirs;
+
+    // A line of the state file: an input (empty `tree`), or a directory of `from` or `to`
+    struct Line {
+        std::string_view tree;
+        uint64_t hash;
+        FileStat stat;
+        std::string_view path;
+    };
+
+    // Goes over a serialized state line by line without building it, until `fn` returns false.
+    // False for a different format, or when `fn` stopped
+    static bool visit(std::string_view content, uint64_t& out_options_hash, const std::function<bool(const Line&)>& fn) {
+        auto header = split(next_line(content), 3);
+        if (header.size() != 3 || header[0] != "headless-state" || parse_number<int>(header[1]) != FORMAT) {
+            return false;
+        }
+        out_options_hash = parse_number<uint64_t>(header[2], 16);
+
+        while (!content.empty()) {
+            auto fields = split(next_line(content), 5);
+            if (fields.size() != 5) continue;
+            bool dir = fields[0] == "from" || fields[0] == "to";
+            Line line = {
+                dir ? fields[0] : std::string_view(),
+                dir ? 0 : parse_number<uint64_t>(fields[0], 16),
+                {
+                    parse_number<uint64_t>(fields[1]),
+                    parse_number<int64_t>(fields[2]),
+                    parse_number<uint64_t>(fields[3])
+                },
+                fields[4]
+            };
+            if (!fn(line)) return false;
+        }
+        return true;
+    }
+
+    static State parse(std::string_view content) {
+        State state;
+        visit(content, state.options_hash, [&](const Line& line) {
+            std::string path(line.path);
+            if (line.tree == "from") {
+                state.from_dirs[path] = line.stat;
+            } else if (line.tree == "to") {
+                state.to_dirs[path] = line.stat;
+            } else {
+                state.entries[path] = { line.hash, line.stat };
+            }
+            return true;
+        });
+        return state;
+    }
+
+    [[nodiscard]] std::string serialize() const {
+        std::string s = "headless-state\t" + std::to_string(FORMAT) + "\t" + to_hex(options_hash) + "\n";
+        // directories go first, a no-op check stops on them as soon as a file was added or removed
+        for (const auto& [tree, dirs] : { std::pair{ "from", &from_dirs }, std::pair{ "to", &to_dirs } }) {
+            for (const auto &[path, stat] : *dirs) {
+                s += tree;
+                s += "\t" + std::to_string(stat.size);
+                s += "\t" + std::to_string(stat.mtime_ns);
+                s += "\t" + std::to_string(stat.inode);
+                s += "\t" + path + "\n";
+            }
+        }
+        for (const auto &[path, entry] : entries) {
+            s += to_hex(entry.hash);
+            s += "\t" + std::to_string(entry.stat.size);
+            s += "\t" + std::to_string(entry.stat.mtime_ns);
+            s += "\t" + std::to_string(entry.stat.inode);
+            s += "\t" + path + "\n";
+        }
+        return s;
+    }
+
+    // Directory mtimes only have the resolution of the kernel's clock tick, so a change right after
+    // a directory was stat'ed can leave its mtime the same. Once `stat_ns - mtime` is longer than a tick, it can't
+    [[nodiscard]] static bool settled(const FileStat& stat, int64_t stat_ns) {
+        return stat_ns - stat.mtime_ns > SETTLE_NS;
+    }
+
+
+    // Returns the previous entry for `path`, if the file is known to be unchanged since then.
+    // `hash` is called only when the file metadata differs from the recorded one
+    [[nodiscard]] std::optional<StateEntry> unchanged(
+        const std::string& path,
+        const FileStat& stat,
+        const std::function<std::optional<uint64_t>()>& hash
+    ) const {
+        auto it = entries.find(path);
+        if (it == entries.end()) {
+            return std::nullopt;
+        }
+        if (it->second.stat == stat) {
+            return it->second;
+        }
+        if (it->second.stat.size != stat.size) {
+            return std::nullopt;
+        }
+        auto current = hash();
+        if (!current || *current != it->second.hash) {
+            return std::nullopt;
+        }
+        return StateEntry{ it->second.hash, stat };
+    }
+
+private:
+    static constexpr int64_t SETTLE_NS = 100'000'000;
+
+    static std::string_view next_line(std::string_view& content) {
+        auto idx = content.find('\n');
+        auto line = content.substr(0, idx);
+        content.remove_prefix(idx == std::string_view::npos ? content.size() : idx + 1);
+        return line;
+    }
+
+    static std::vector<std::string_view> split(std::string_view line, size_t max) {
+        std::vector<std::string_view> fields;
+        while (fields.size() + 1 < max) {
+            auto idx = line.find('\t');
+            if (idx == std::string_view::npos) break;
+            fields.push_back(line.substr(0, idx));
+            line.remove_prefix(idx + 1);
+        }
+        fields.push_back(line);
+        return fields;
+    }
+
+    template<typename T>
+    static T parse_number(std::string_view s, int base = 10) {
+        T value = 0;
+        std::from_chars(s.data(), s.data() + s.size(), value, base);
+        return value;
+    }
+};
+
+#endif
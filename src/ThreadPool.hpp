@@ -0,0 +1,81 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// Runs a fixed list of tasks on `threads` workers. Every worker owns a deque,
+// takes tasks from its front and, once it runs dry, steals from the back of the others.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(size_t threads) : queues(threads ? threads : 1) {}
+
+    // `tasks` are dealt round-robin in the given order, so the first ones start first
+    void run(const std::vector<size_t>& tasks, const std::function<void(size_t)>& fn) {
+        for (size_t i = 0; i < tasks.size(); i++) {
+            queues[i % queues.size()].tasks.push_back(tasks[i]);
+        }
+
+        std::vector<std::thread> workers;
+        for (size_t w = 0; w < queues.size(); w++) {
+            workers.emplace_back([this, w, &fn] { work(w, fn); });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    std::vector<Queue> queues;
+    std::mutex error_mutex;
+    std::exception_ptr error;
+
+    void work(size_t self, const std::function<void(size_t)>& fn) {
+        while (auto task = next(self)) {
+            try {
+                fn(*task);
+            } catch (...) {
+                std::lock_guard lock(error_mutex);
+                if (!error) error = std::current_exception();
+            }
+        }
+    }
+
+    std::optional<size_t> next(size_t self) {
+        {
+            auto& own = queues[self];
+            std::lock_guard lock(own.mutex);
+            if (!own.tasks.empty()) {
+                auto task = own.tasks.front();
+                own.tasks.pop_front();
+                return task;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); i++) {
+            auto& victim = queues[(self + i) % queues.size()];
+            std::lock_guard lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                auto task = victim.tasks.back();
+                victim.tasks.pop_back();
+                return task;
+            }
+        }
+        return std::nullopt;
+    }
+};
+
+#endif
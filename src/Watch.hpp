@@ -0,0 +1,133 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#ifdef __linux__
+
+#include <filesystem>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+// Watches a directory tree with inotify and reports which files in it were changed or removed
+class Watcher {
+public:
+    struct Changes {
+        std::set<std::filesystem::path> changed;
+        std::set<std::filesystem::path> removed;
+    };
+
+    explicit Watcher(std::filesystem::path root) : root(std::move(root)) {
+        fd = inotify_init1(IN_CLOEXEC);
+        if (fd >= 0) {
+            addTree("");
+        }
+    }
+
+    ~Watcher() {
+        if (fd >= 0) close(fd);
+    }
+
+    Watcher(const Watcher&) = delete;
+    Watcher& operator=(const Watcher&) = delete;
+
+    [[nodiscard]] bool valid() const {
+        return fd >= 0;
+    }
+
+    // Blocks until something changes, then waits `settle_ms` more for related events
+    // (editors often write a file in several steps) and returns all of them at once.
+    // Paths are relative to the root
+    Changes wait(int settle_ms = 10) {
+        Changes changes;
+        read(changes, -1);
+        while (read(changes, settle_ms)) {}
+        return changes;
+    }
+
+private:
+    static constexpr uint32_t MASK = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE;
+
+    int fd = -1;
+    std::filesystem::path root;
+    std::map<int, std::filesystem::path> dirs;
+
+    // returns paths of all files inside the added directory
+    std::vector<std::filesystem::path> addTree(const std::filesystem::path& dir) {
+        std::vector<std::filesystem::path> files;
+        int wd = inotify_add_watch(fd, (root / dir).c_str(), MASK);
+        if (wd < 0) return files;
+        dirs[wd] = dir;
+
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(root / dir, ec)) {
+            auto path = dir / entry.path().filename();
+            if (entry.is_directory(ec)) {
+                auto nested = addTree(path);
+                files.insert(files.end(), nested.begin(), nested.end());
+            } else {
+                files.push_back(path);
+            }
+        }
+        return files;
+    }
+
+    void removeTree(const std::filesystem::path& dir) {
+        for (auto it = dirs.begin(); it != dirs.end();) {
+            auto relative = it->second.lexically_relative(dir);
+            if (!relative.empty() && *relative.begin() != "..") {
+                inotify_rm_watch(fd, it->first);
+                it = dirs.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    bool read(Changes& changes, int timeout_ms) {
+        pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, timeout_ms) <= 0) {
+            return false;
+        }
+
+        alignas(inotify_event) char buffer[16384];
+        auto length = ::read(fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            return false;
+        }
+
+        for (char* p = buffer; p < buffer + length; p += sizeof(inotify_event) + reinterpret_cast<inotify_event*>(p)->len) {
+            const auto* event = reinterpret_cast<inotify_event*>(p);
+            auto it = dirs.find(event->wd);
+            if (it == dirs.end() || event->len == 0) continue;
+            auto path = it->second / event->name;
+
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    for (const auto& file : addTree(path)) {
+                        changes.changed.insert(file);
+                        changes.removed.erase(file);
+                    }
+                } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    removeTree(path);
+                    changes.removed.insert(path);
+                }
+            } else if (event->mask & (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                changes.changed.insert(path);
+                changes.removed.erase(path);
+            } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                changes.removed.insert(path);
+                changes.changed.erase(path);
+            }
+        }
+        return true;
+    }
+};
+
+#endif
+
+#endif
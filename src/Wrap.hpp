@@ -0,0 +1,236 @@
+#ifndef WRAP_H
+#define WRAP_H
+
+#include "headless.hpp"
+#include "utils.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// `headless wrap -- <compiler> <args> foo.hpp` compiles the `.cpp` generated from `foo.hpp` without writing it anywhere:
+// the code goes to the compiler's stdin, and generated headers (`foo.hpp` and project headers it includes)
+// are put into a temporary directory that is searched before the original ones and removed afterwards
+
+// Compiler options that take the next argument as their value, so it's not an input file
+inline bool takes_value(const std::string& arg) {
+    static const std::set<std::string> options = {
+        "-o", "-x", "-I", "-iquote", "-isystem", "-idirafter", "-include", "-imacros",
+        "-MF", "-MT", "-MQ", "-D", "-U", "-Xclang", "-target", "--target", "-arch"
+    };
+    return options.contains(arg);
+}
+
+// Index of the header to compile in `command`, or -1
+inline long find_header(const std::vector<std::string>& command) {
+    long found = -1;
+    for (long i = 1; i < static_cast<long>(command.size()); i++) {
+        const auto& arg = command[i];
+        if (arg.empty() || arg[0] == '-' || takes_value(command[i - 1])) continue;
+        auto ex = ext(arg);
+        if (ex == "hpp" || ex == "h") found = i;
+    }
+    return found;
+}
+
+// Directories from `-I` and `-iquote`, where quoted includes can be found
+inline std::vector<std::filesystem::path> include_dirs(const std::vector<std::string>& command) {
+    std::vector<std::filesystem::path> dirs;
+    for (size_t i = 1; i < command.size(); i++) {
+        for (const std::string option : { "-I", "-iquote" }) {
+            if (command[i] == option && i + 1 < command.size()) {
+                dirs.emplace_back(command[++i]);
+            } else if (command[i].starts_with(option) && command[i].size() > option.size()) {
+                dirs.emplace_back(command[i].substr(option.size()));
+            }
+        }
+    }
+    return dirs;
+}
+
+// Targets of `#include "..."` in `code`
+inline std::vector<std::string> quoted_includes(const std::string& code) {
+    std::vector<std::string> includes;
+    std::stringstream s(code);
+    std::string line;
+    while (std::getline(s, line)) {
+        ltrim(line);
+        if (line.empty() || line[0] != '#') continue;
+        line.erase(0, 1);
+        ltrim(line);
+        if (!line.starts_with("include")) continue;
+        auto start = line.find('"');
+        auto end = line.find('"', start + 1);
+        if (start == std::string::npos || end == std::string::npos) continue;
+        includes.push_back(line.substr(start + 1, end - start - 1));
+    }
+    return includes;
+}
+
+// Puts the generated header for `header` into `overlay / name`, and does the same for project headers it includes,
+// so they are found next to it before the originals. Returns the generated `.cpp` code.
+// With `forward_declare`, includes are found next to the includer, then in `-I` and `-iquote` directories
+inline std::string write_overlay(
+    const headless::Options& options,
+    bool forward_declare,
+    const std::filesystem::path& header,
+    const std::filesystem::path& name,
+    const std::filesystem::path& overlay,
+    const std::vector<std::filesystem::path>& dirs,
+    std::set<std::filesystem::path>& visited
+) {
+    auto code = read_file(header);
+    if (!code) return "";
+    visited.insert(std::filesystem::weakly_canonical(header));
+
+    auto header_options = options;
+    if (forward_declare) {
+        header_options.forward_declare = [header, &dirs](const std::string& includer, const std::string& include) -> std::optional<std::pair<std::string, std::string>> {
+            auto base = includer.empty() ? header.parent_path() : std::filesystem::path(includer).parent_path();
+            std::vector<std::filesystem::path> candidates = { base / include };
+            for (const auto& dir : dirs) candidates.push_back(dir / include);
+            for (const auto& candidate : candidates) {
+                if (auto found = read_file(candidate)) return std::pair{ candidate.lexically_normal().string(), std::move(*found) };
+            }
+            return std::nullopt;
+        };
+    }
+
+    std::string h_code, c_code;
+    auto stem = filename(header.filename());
+    if (exists(header.parent_path() / (stem + ".cpp")) || exists(header.parent_path() / (stem + ".c")) || exists(header.parent_path() / (stem + ".cc"))) {
+        // has its own source, used as is, same as when syncing
+        h_code = code.value();
+    } else {
+        std::pair<std::string, std::string> output_path = { name.generic_string(), (name.parent_path() / (stem + ".cpp")).generic_string() };
+        std::tie(h_code, c_code) = headless::process(code.value(), header.string(), output_path, header_options);
+    }
+    mkdirp(overlay / name.parent_path());
+    write_file(overlay / name, h_code);
+
+    for (const auto& include : quoted_includes(code.value())) {
+        auto included = (name.parent_path() / include).lexically_normal();
+        // outside of the overlay, can't be put before the original
+        if (included.empty() || *included.begin() == "..") continue;
+        auto ex = ext(include);
+        if (ex != "hpp" && ex != "h") continue;
+
+        std::optional<std::filesystem::path> found;
+        if (exists(header.parent_path() / include)) {
+            found = header.parent_path() / include;
+        } else {
+            for (const auto& dir : dirs) {
+                if (exists(dir / include)) {
+                    found = dir / include;
+                    break;
+                }
+            }
+        }
+        if (!found || visited.contains(std::filesystem::weakly_canonical(*found))) continue;
+        write_overlay(options, forward_declare, *found, included, overlay, dirs, visited);
+    }
+    return c_code;
+}
+
+// Runs `command` with `input` as its stdin, returns its exit code
+inline int run_with_input(const std::vector<std::string>& command, const std::string& input) {
+    int fds[2];
+    if (pipe(fds) != 0) return 1;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[0], STDIN_FILENO);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    posix_spawn_file_actions_addclose(&actions, fds[1]);
+
+    std::vector<char*> argv;
+    for (const auto& arg : command) argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+
+    pid_t pid;
+    int error = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[0]);
+    if (error != 0) {
+        close(fds[1]);
+        std::cerr << "headless: Can't run \"" << command[0] << "\": " << std::strerror(error) << std::endl;
+        return 1;
+    }
+
+    // the compiler may exit without reading everything, that's its error to report
+    signal(SIGPIPE, SIG_IGN);
+    size_t written = 0;
+    while (written < input.size()) {
+        auto n = write(fds[1], input.data() + written, input.size() - written);
+        if (n <= 0) break;
+        written += n;
+    }
+    close(fds[1]);
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return 1;
+    }
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    return 128 + (WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+}
+
+inline int wrap(const headless::Options& options, std::vector<std::string> command, bool forward_declare = false) {
+    auto header_index = find_header(command);
+    if (command.empty() || header_index < 0) {
+        std::cerr << "headless: No .hpp or .h file to compile in the command" << std::endl;
+        return 1;
+    }
+    std::filesystem::path header = command[header_index];
+
+    auto overlay_template = (std::filesystem::temp_directory_path() / "headless-XXXXXX").string();
+    if (!mkdtemp(overlay_template.data())) {
+        std::cerr << "headless: Can't create a temporary directory" << std::endl;
+        return 1;
+    }
+    std::filesystem::path overlay = overlay_template;
+
+    auto stem = filename(header.filename());
+    std::set<std::filesystem::path> visited;
+    auto c_code = write_overlay(options, forward_declare, header, header.filename(), overlay, include_dirs(command), visited);
+    // for stdin, quoted includes are searched in the current directory first, which may have the original header
+    auto include = "#include \"" + header.filename().string() + "\"";
+    if (c_code.starts_with(include)) {
+        c_code.replace(0, include.size(), "#include \"" + (overlay / header.filename()).string() + "\"");
+    }
+
+    // `-c` would name the object after the input, which is `-` now
+    bool compile_only = false, has_output = false;
+    for (size_t i = 1; i < command.size(); i++) {
+        if (command[i] == "-c") compile_only = true;
+        if (command[i] == "-o" || (command[i].starts_with("-o") && !takes_value(command[i - 1]))) has_output = true;
+    }
+
+    std::vector<std::string> args(command.begin(), command.begin() + header_index);
+    args.insert(args.end(), { "-iquote", overlay.string() });
+    if (compile_only && !has_output) {
+        args.insert(args.end(), { "-o", stem + ".o" });
+    }
+    args.insert(args.end(), { "-x", "c++", "-", "-x", "none" });
+    args.insert(args.end(), command.begin() + header_index + 1, command.end());
+
+    int code = run_with_input(args, c_code);
+
+    std::error_code ec;
+    std::filesystem::remove_all(overlay, ec);
+    return code;
+}
+
+#endif
@@ -0,0 +1,215 @@
+#include "headless.hpp"
+#include "IfDefParser.hpp"
+#include "Extractor.hpp"
+#include "LexerExtractor.hpp"
+#include "Renderer.hpp"
+#include "IncludePruner.hpp"
+#include "ForwardDeclarations.hpp"
+#include "Hash.hpp"
+
+#include <filesystem>
+#include <random>
+#include <set>
+
+#include <clang/Tooling/Tooling.h>
+#include <clang/Basic/FileManager.h>
+#include <llvm/Support/VirtualFileSystem.h>
+
+namespace headless {
+
+static std::string toHeaderToken(const std::string& filename) {
+    std::string result = filename;
+    for (char& c : result) {
+        if (!std::isalnum(static_cast<unsigned char>(c))) {
+            c = '_';
+        } else {
+            c = std::toupper(static_cast<unsigned char>(c));
+        }
+    }
+    return result;
+}
+
+const std::vector<std::string> CLANG_ARGS = {
+    "-std=c++17",
+    "-fsyntax-only",
+    "-ffreestanding",
+    "-Wno-everything",
+    "-Wno-error",
+    "-nostdinc",
+    "-nostdinc++",
+    "-E"
+};
+
+// the in-memory filesystem keeps every file added to it, so it's started over once in a while
+const unsigned SESSION_MAX_FILES = 1000;
+const size_t SESSION_MAX_BYTES = 64 * 1024 * 1024;
+
+// Gives the code to clang without copying it once more
+class StringBuffer : public llvm::MemoryBuffer {
+public:
+    explicit StringBuffer(std::string code) : code(std::move(code)) {
+        init(this->code.data(), this->code.data() + this->code.size(), true);
+    }
+
+    BufferKind getBufferKind() const override {
+        return MemoryBuffer_Malloc;
+    }
+
+private:
+    std::string code;
+};
+
+// Headers are given to clang in memory, over the real filesystem for anything else it looks up,
+// the same layering as `runToolOnCodeWithArgs`
+struct ExtractSession::State {
+    llvm::IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem> fs;
+    llvm::IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> overlay;
+    llvm::IntrusiveRefCntPtr<clang::FileManager> fileManager;
+    size_t bytes = 0;
+
+    State() : fs(new llvm::vfs::InMemoryFileSystem), overlay(new llvm::vfs::OverlayFileSystem(llvm::vfs::getRealFileSystem())) {
+        fs->setCurrentWorkingDirectory("/");
+        overlay->pushOverlay(fs);
+        fileManager = new clang::FileManager(clang::FileSystemOptions(), overlay);
+    }
+};
+
+ExtractSession::ExtractSession() = default;
+
+ExtractSession::~ExtractSession() = default;
+
+Extraction ExtractSession::extract(std::string_view code, const std::string& path, Engine engine) {
+    auto [ifdefs, clearedCode] = parseIfDefs(code);
+    if (engine == Engine::Lexer || prescan) {
+        // with the clang engine, the lexer only proves that there is nothing to extract,
+        // which is the case for most headers with only declarations
+        auto extraction = LexerExtractor(ifdefs, clearedCode).extract();
+        if (extraction && (engine == Engine::Lexer || (extraction->fragments.empty() && extraction->replacements.empty()))) {
+            withoutClang++;
+            return std::move(*extraction);
+        }
+    }
+
+    if (!state || files == SESSION_MAX_FILES || state->bytes > SESSION_MAX_BYTES) {
+        state = std::make_unique<State>();
+        files = 0;
+    }
+    // the file manager caches files by name, so every one gets its own
+    auto name = "/headless/" + std::to_string(files++) + "/" + std::filesystem::path(path).filename().string();
+    state->bytes += clearedCode.size();
+    state->fs->addFile(name, 0, std::make_unique<StringBuffer>(std::move(clearedCode)));
+
+    std::vector<std::string> commandLine = { "clang-tool" };
+    commandLine.insert(commandLine.end(), CLANG_ARGS.begin(), CLANG_ARGS.end());
+    commandLine.push_back(name);
+
+    auto result = std::make_shared<Extraction>();
+    clang::tooling::ToolInvocation invocation(commandLine, std::make_unique<ExtractAction>(result, ifdefs), state->fileManager.get());
+    invocation.run();
+    return std::move(*result);
+}
+
+Extraction extract(std::string_view code, const std::string& path, Engine engine) {
+    ExtractSession session;
+    return session.extract(code, path, engine);
+}
+
+std::optional<Extraction> extractWithLexer(std::string_view code) {
+    auto [ifdefs, clearedCode] = parseIfDefs(code);
+    return LexerExtractor(ifdefs, clearedCode).extract();
+}
+
+std::pair<std::string, std::string> render(
+    std::string_view code,
+    const Extraction& extraction,
+    const std::string& path,
+    const std::pair<std::string, std::string>& output_path,
+    const Options& options
+) {
+    std::optional<StableHeaderLines> stableHeaderLines;
+    if (options.add_lines && options.stable_lines) {
+        // the #ifndef guard added below takes 3 lines
+        stableHeaderLines = StableHeaderLines{ output_path.first, options.wrap_headers ? 4 : 1 };
+    }
+
+    // moved includes are taken out of the header like any other replaced code
+    std::vector<IncludeDirective> moved;
+    std::vector<ForwardDeclaredInclude> declared;
+    if (options.prune_includes) {
+        moved = movableIncludes(code, extraction);
+    }
+    if (options.forward_declare) {
+        declared = forwardDeclarableIncludes(code, extraction, options.forward_declare);
+    }
+    std::optional<Extraction> edited;
+    if (!moved.empty() || !declared.empty()) {
+        edited = extraction;
+        for (const auto& include : moved) {
+            edited->replacements.push_back({ { include.start, include.end }, "" });
+        }
+        for (const auto& include : declared) {
+            edited->replacements.push_back({ { include.include.start, include.include.end }, include.declarations });
+        }
+    }
+
+    Renderer renderer(code, edited ? *edited : extraction, options.add_lines ? std::optional{ path } : std::nullopt, stableHeaderLines);
+    auto h_code = renderer.getModifiedHeader();
+    std::string c_code = "#include \"" + output_path.first + "\"\n";
+    std::set<std::string> included;
+    for (const auto& include : declared) {
+        if (included.insert(include.include.header).second) {
+            c_code.append("#include \"").append(include.include.header).append("\"\n");
+        }
+    }
+    for (const auto& include : moved) {
+        c_code.append("#include <").append(include.header).append(">\n");
+    }
+    c_code += "\n";
+    renderer.appendCppImplementations(c_code);
+    if (options.wrap_headers) {
+        auto token = toHeaderToken(output_path.first);
+        if (options.reproducible) {
+            token += "_" + to_hex(hash64(h_code)).substr(0, 8);
+        } else if (options.wrap_headers_add_random) {
+            thread_local std::minstd_rand random(std::random_device{}());
+            token += "_" + std::to_string(random() % 100000);
+        }
+        std::string wrapped;
+        wrapped.reserve(h_code.size() + 2 * token.size() + 32);
+        wrapped.append("#ifndef ").append(token).append("\n#define ").append(token).append("\n\n");
+        wrapped.append(h_code).append("\n\n#endif");
+        h_code = std::move(wrapped);
+    }
+    return { std::move(h_code), std::move(c_code) };
+}
+
+std::vector<std::string> prunedIncludes(std::string_view code, const Extraction& extraction) {
+    std::vector<std::string> headers;
+    for (auto& include : movableIncludes(code, extraction)) {
+        headers.push_back(std::move(include.header));
+    }
+    return headers;
+}
+
+std::vector<std::pair<std::string, std::vector<std::string>>> forwardDeclaredIncludes(
+    std::string_view code,
+    const Extraction& extraction,
+    const IncludeResolver& resolve
+) {
+    std::vector<std::pair<std::string, std::vector<std::string>>> includes;
+    for (auto& include : forwardDeclarableIncludes(code, extraction, resolve)) {
+        includes.emplace_back(std::move(include.include.header), std::move(include.classes));
+    }
+    return includes;
+}
+
+std::pair<std::string, std::string> process(
+    std::string_view code,
+    const std::string& path,
+    const std::pair<std::string, std::string>& output_path,
+    const Options& options
+) {
+    return render(code, extract(code, path, options.engine), path, output_path, options);
+}
+
+}
@@ -0,0 +1,108 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include "Extraction.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// In-memory API of `headless`, also built as a library (`libheadless`), all in `namespace headless`.
+// Takes the code of a header (not copied, so it can be a mapped file) and returns the generated `.hpp` and `.cpp` code,
+// never touches the filesystem.
+// All functions can be called from several threads at once
+
+namespace headless {
+
+// What finds definitions in headers: clang itself, or a faster lexer-only pass that approximates it
+// and falls back to clang for headers it doesn't fully understand
+enum class Engine : uint8_t {
+    Clang,
+    Lexer
+};
+
+// Finds a header included with `#include "..."`: `includer` is the header the include is in, empty for the one being
+// rendered, otherwise a path this returned before. Gives the path of the included header and its code,
+// nothing when it can't be found
+using IncludeResolver = std::function<std::optional<std::pair<std::string, std::string>>(const std::string& includer, const std::string& include)>;
+
+// Fields get added as generation learns new things, set them by name: `{ .wrap_headers = true }`
+struct Options {
+    bool wrap_headers = false;
+    // header guards get a random suffix, so every render of the same header gives a different guard
+    bool wrap_headers_add_random = false;
+    bool add_lines = false;
+    bool stable_lines = false;
+    bool reproducible = false;
+    Engine engine = Engine::Clang;
+    // standard includes that nothing left in the header needs go to the `.cpp` (see `prunedIncludes`)
+    bool prune_includes = false;
+    // when set, project includes that the header needs only for pointers and references to their classes are replaced
+    // with forward declarations, and go to the `.cpp` (see `forwardDeclaredIncludes`)
+    IncludeResolver forward_declare = nullptr;
+};
+
+// Runs clang over `code`; `path` only names the file for clang, includes are not resolved
+Extraction extract(std::string_view code, const std::string& path, Engine engine = Engine::Clang);
+
+// Only the lexer engine, nothing if `code` has to go through clang
+std::optional<Extraction> extractWithLexer(std::string_view code);
+
+// `extract` for many files in a row, sharing clang's file manager and in-memory filesystem between them,
+// so that small headers don't pay for setting them up every time. Use one session per thread
+class ExtractSession {
+public:
+    ExtractSession();
+    ~ExtractSession();
+
+    Extraction extract(std::string_view code, const std::string& path, Engine engine = Engine::Clang);
+
+    // Whether headers the lexer finds nothing to extract in may skip clang. Off until the `engines` test
+    // has shown on a clang build that clang finds nothing in them either
+    bool prescan = false;
+    // Files extracted without running clang
+    unsigned withoutClang = 0;
+
+private:
+    struct State;
+    std::unique_ptr<State> state;
+    unsigned files = 0;
+};
+
+// Builds generated `{ .hpp, .cpp }` code from an extraction of `code`, without clang.
+// `path` is used for #line, `output_path` are paths of generated files for #include and header guards
+std::pair<std::string, std::string> render(
+    std::string_view code,
+    const Extraction& extraction,
+    const std::string& path,
+    const std::pair<std::string, std::string>& output_path,
+    const Options& options = {}
+);
+
+// Standard headers whose includes `render` moves from the generated header into the `.cpp` with `prune_includes`:
+// nothing left in the header uses their names, and nothing else in it seems to count on them
+std::vector<std::string> prunedIncludes(std::string_view code, const Extraction& extraction);
+
+// Project includes that `render` replaces with forward declarations with `forward_declare`, and the classes declared instead
+std::vector<std::pair<std::string, std::vector<std::string>>> forwardDeclaredIncludes(
+    std::string_view code,
+    const Extraction& extraction,
+    const IncludeResolver& resolve
+);
+
+// `extract` and `render` at once
+std::pair<std::string, std::string> process(
+    std::string_view code,
+    const std::string& path,
+    const std::pair<std::string, std::string>& output_path,
+    const Options& options = {}
+);
+
+}
+
+#endif
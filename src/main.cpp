@@ -1,68 +1,38 @@
-#include "utils.hpp"
+#include "headless.hpp"
 #include "IfDefParser.hpp"
-#include "Extractor.hpp"
+#include "utils.hpp"
+#include "ThreadPool.hpp"
+#include "State.hpp"
+#include "Hash.hpp"
+#include "Cache.hpp"
+#include "Watch.hpp"
+#include "Wrap.hpp"
+#include "Snapshot.hpp"
+#include "Prefetcher.hpp"
+#include "BatchedWriter.hpp"
+#include "PrecompiledHeader.hpp"
 
-#include <clang/Tooling/Tooling.h>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
 
 #include <cxxopts.hpp>
 
-std::string toHeaderToken(const std::string& filename) {
-    std::string result = filename;
-    for (char& c : result) {
-        if (std::isspace(static_cast<unsigned char>(c)) || c == '.') {
-            c = '_';
-        } else {
-            c = std::toupper(static_cast<unsigned char>(c));
-        }
-    }
-    return result;
-}
-
-struct Options {
-    bool wrap_headers = false;
-    bool wrap_headers_add_random = true;
-    bool add_lines = false;
-    bool incremental = false;
-};
+using namespace headless;
 
-std::pair<std::string, std::string> process(
-    const std::string& code,
-    const std::string& path,
-    const std::pair<std::string, std::string>& output_path,
-    const Options& options = {}
-) {
-    const std::vector<std::string> args = {
-        "-std=c++17",
-        "-fsyntax-only",
-        "-ffreestanding",
-        "-Wno-everything",
-        "-Wno-error",
-        "-nostdinc",
-        "-nostdinc++",
-        "-E"
-    };
-    auto [rules, clearedCode] = parseIfDefs(code);
-
-    auto result = std::make_shared<ExtractionResult>();
-    auto action = std::make_unique<ExtractAction>(code, result, rules, options.add_lines ? std::optional{ path } : std::nullopt);
-    clang::tooling::runToolOnCodeWithArgs(std::move(action), clearedCode, args, path);
-    result->c_code = "#include \"" + output_path.first + "\"\n\n" + result->c_code;
-    if (options.wrap_headers) {
-        auto token = toHeaderToken(output_path.first);
-        if (options.wrap_headers_add_random) {
-            token += "_" + std::to_string((rand() % 100000));
-        }
-        result->h_code = "#ifndef " + token + "\n#define " + token + "\n\n" + result->h_code + "\n\n#endif";
-    }
-    return { result->h_code, result->c_code };
-}
+#ifdef __linux__
+#include <spawn.h>
+#include <sys/wait.h>
+#endif
 
 struct CodeFile {
     bool is_source;
     bool generated;
     std::string input;
     std::string output;
-    long last_modified;
 };
 
 std::string write_sources(const std::vector<CodeFile>& sources) {
@@ -74,14 +44,13 @@ std::string write_sources(const std::vector<CodeFile>& sources) {
         is_source,
         generated,
         input,
-        output,
-        last_modified
+        output
     ] : sources) {
         if (is_source) {
             s << "\t" << output;
         } else if (written.contains(input)) continue;
         if (generated) {
-            s << "\t# from \"" << input << "\", last modified: " << last_modified;
+            s << "\t# from \"" << input << "\"";
             written.emplace(input);
         }
         s << "\n";
@@ -90,106 +59,1164 @@ std::string write_sources(const std::vector<CodeFile>& sources) {
     return s.str();
 }
 
-std::map<std::string, long> read_sources(const std::string& file) {
-    std::map<std::string, long> entries;
+uint64_t options_hash(const Options& options) {
+    std::string s = HEADLESS_VERSION;
+    s += options.wrap_headers ? "w" : "-";
+    s += options.wrap_headers_add_random ? "r" : "-";
+    s += options.add_lines ? "l" : "-";
+    s += options.stable_lines ? "s" : "-";
+    s += options.reproducible ? "p" : "-";
+    s += options.engine == Engine::Lexer ? "x" : "-";
+    s += options.prune_includes ? "i" : "-";
+    s += options.forward_declare ? "f" : "-";
+    return hash64(s);
+}
 
-    std::regex regex(R"(.*# from \"(.*)\", last modified: (.*)\s*)");
-    std::istringstream stream(file);
-    std::string line;
-    std::smatch match;
-    while (std::getline(stream, line)) {
-        if (std::regex_match(line, match, regex)) {
-            try {
-                auto path = match[1].str();
-                long last_modified = std::stol(match[2].str());
-                entries[path] = last_modified;
-            } catch (...) {}
-        }
+// Size of `headers` preprocessed together, what every includer of a header that includes them goes through.
+// Measured once per set of headers with $CXX (or `c++`), nothing without a compiler
+std::optional<size_t> preprocessed_size(const std::vector<std::string>& headers) {
+    static std::mutex mutex;
+    static std::map<std::vector<std::string>, std::optional<size_t>> sizes;
+    {
+        std::lock_guard lock(mutex);
+        if (auto it = sizes.find(headers); it != sizes.end()) return it->second;
     }
 
-    return entries;
+    // names come from the list of standard headers, nothing to quote
+    std::string command = "printf '";
+    for (const auto& header : headers) command += "#include <" + header + ">\\n";
+    const char* cxx = std::getenv("CXX");
+    command += "' | " + std::string(cxx ? cxx : "c++") + " -x c++ -std=c++20 -E -P - 2>/dev/null";
+
+    std::optional<size_t> size;
+    if (FILE* pipe = popen(command.c_str(), "r")) {
+        char buffer[65536];
+        size_t total = 0, n;
+        while ((n = fread(buffer, 1, sizeof(buffer), pipe)) > 0) total += n;
+        if (pclose(pipe) == 0) size = total;
+    }
+    // other workers don't wait for the compiler, even if two of them happen to run it for the same headers
+    std::lock_guard lock(mutex);
+    return sizes.emplace(headers, size).first->second;
 }
 
-long get_last_modified(const std::map<std::string, long>& times, const std::string& path) {
-    auto it = times.find(path);
-    if (it != times.end())
+// How long $CXX (or `c++`) with $CXXFLAGS takes to parse `header` on its own: the best of two runs,
+// less the same for an empty input. Nothing when it doesn't compile that way (a third-party header outside of the default paths)
+std::optional<double> parse_cost_ms(const std::string& header) {
+    // the name goes into a shell command
+    if (header.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-+./") != std::string::npos) return std::nullopt;
+
+    const char* cxx = std::getenv("CXX");
+    const char* flags = std::getenv("CXXFLAGS");
+    auto compile = std::string(cxx ? cxx : "c++") + " " + (flags ? flags : "") + " -x c++ -std=c++20 -fsyntax-only - >/dev/null 2>&1";
+    auto time = [&](const std::string& input) -> std::optional<double> {
+        std::optional<double> best;
+        for (int run = 0; run < 2; run++) {
+            auto start = std::chrono::steady_clock::now();
+            if (std::system(("printf '" + input + "' | " + compile).c_str()) != 0) return std::nullopt;
+            auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            best = std::min(best.value_or(ms), ms);
+        }
+        return best;
+    };
+    static const auto baseline = time("");
+    auto cost = time("#include <" + header + ">\\n");
+    if (!cost || !baseline) return std::nullopt;
+    return std::max(0.0, *cost - *baseline);
+}
+
+// Project headers that generated headers include, read to see what they declare for forward declarations.
+// Kept for one sync, as the same headers are included over and over
+class IncludedHeaders {
+public:
+    explicit IncludedHeaders(std::filesystem::path from) : from(std::move(from)) {}
+
+    // Finds `#include "..."` next to the includer and then from the root of `from`, as with `-I<from>`.
+    // The header being rendered is in `dir` of `from`
+    IncludeResolver resolver(const std::filesystem::path& dir) {
+        return [this, dir](const std::string& includer, const std::string& include) -> std::optional<std::pair<std::string, std::string>> {
+            auto base = includer.empty() ? from / dir : std::filesystem::path(includer).parent_path();
+            for (const auto& candidate : { base / include, from / include }) {
+                auto path = candidate.lexically_normal().string();
+                if (auto code = read(path)) return std::pair{ path, std::move(*code) };
+            }
+            return std::nullopt;
+        };
+    }
+
+    // Hash of every project header `code` includes, directly or not, that is what its outputs depend on besides itself
+    uint64_t dependencies_hash(const std::filesystem::path& dir, const std::string& code) {
+        auto resolve = resolver(dir);
+        std::string s;
+        std::set<std::string> visited;
+        std::vector<std::pair<std::string, std::string>> queue = { { "", code } };
+        for (size_t i = 0; i < queue.size(); i++) {
+            for (const auto& include : quoted_includes(queue[i].second)) {
+                auto found = resolve(queue[i].first, include);
+                if (!found || !visited.insert(found->first).second) continue;
+                s.append(found->first).append("\n").append(to_hex(hash64(found->second))).append("\n");
+                queue.push_back(std::move(*found));
+            }
+        }
+        return hash64(s);
+    }
+
+    // Forgets everything read, when headers may have changed
+    void clear() {
+        std::lock_guard lock(mutex);
+        codes.clear();
+    }
+
+private:
+    std::filesystem::path from;
+    std::mutex mutex;
+    std::map<std::string, std::optional<std::string>> codes;
+
+    std::optional<std::string> read(const std::string& path) {
+        std::lock_guard lock(mutex);
+        auto it = codes.find(path);
+        if (it == codes.end()) it = codes.emplace(path, read_file(path)).first;
         return it->second;
-    return 0;
+    }
+};
+
+struct SyncItem {
+    std::filesystem::path dir;
+    std::string name;
+    std::filesystem::path from;
+    std::filesystem::path to;
+    uintmax_t size;
+};
+
+struct SyncResult {
+    std::vector<CodeFile> sources;
+    std::optional<StateEntry> state;
+    bool generated = false;
+    // nothing to extract, so clang didn't have to run
+    bool without_clang = false;
+};
+
+class Prefetcher;
+class BatchedWriter;
+
+// Built with designated initializers, fields that aren't named keep their defaults
+struct SyncContext {
+    const Options& options;
+    const State& state;
+    GenerationCache* cache;
+    // where extraction results are kept, to re-render outputs without clang when only options change
+    std::filesystem::path extract_dir;
+    CopyMode copy_mode = CopyMode::Auto;
+    // read inputs ahead of the workers and write generated outputs in batches with io_uring (Linux only)
+    bool io_uring = false;
+    // both trees as they were before the sync; without them (in watch mode) the file system is asked
+    const Snapshot* from_snapshot = nullptr;
+    const Snapshot* to_snapshot = nullptr;
+    Prefetcher* prefetcher = nullptr;
+    BatchedWriter* writer = nullptr;
+    // with forward declarations, where included headers are read from
+    IncludedHeaders* included = nullptr;
+    // large inputs are mapped instead of read; not while watching, where editors rewrite files as they are read
+    // and touching a mapping of a file that got shorter raises SIGBUS
+    bool map_inputs = true;
+};
+
+uint64_t extraction_key(uint64_t content_hash, const std::string& name, Engine engine) {
+    return hash64(to_hex(content_hash) + "\n" + ext(name) + "\n" + HEADLESS_VERSION + (engine == Engine::Lexer ? "\nlexer" : ""));
 }
 
-void sync(
-    const std::filesystem::path& dir,
+// Extraction of `code`, from `extract_dir` if it was already done for the same content
+Extraction load_extraction(const SyncContext& context, std::string_view code, const std::string& name, const std::string& path, bool& out_without_clang) {
+    auto file = context.extract_dir / to_hex(extraction_key(hash64(code), name, context.options.engine));
+    if (auto stored = read_file(file)) {
+        if (auto extraction = parseExtraction(stored.value())) {
+            return extraction.value();
+        }
+    }
+    // each worker thread keeps its own clang state between files
+    thread_local ExtractSession session;
+    auto withoutClang = session.withoutClang;
+    auto extraction = session.extract(code, path, context.options.engine);
+    out_without_clang = session.withoutClang != withoutClang;
+    write_file(file, serializeExtraction(extraction));
+    return extraction;
+}
 
+// Removes stored extractions of inputs that don't exist anymore
+void prune_extractions(const std::filesystem::path& extract_dir, const State& state, Engine engine) {
+    std::set<std::string> keep;
+    for (const auto &[path, entry] : state.entries) {
+        keep.insert(to_hex(extraction_key(entry.hash, path, engine)));
+    }
+    for (const auto &[name, is_dir] : read_dir(extract_dir)) {
+        if (!is_dir && !keep.contains(name)) {
+            unlink(extract_dir / name);
+        }
+    }
+}
+
+constexpr const char* PCH_FILE = "headless_pch.hpp";
+constexpr const char* PCH_CMAKE_FILE = "pch.cmake";
+
+bool is_input(const std::filesystem::path& dir, const std::string& name) {
+    if (name == ".DS_Store")
+        return false;
+    if (dir.empty() && (name == "sources.cmake" || name == PCH_FILE || name == PCH_CMAKE_FILE))
+        return false;
+    return true;
+}
+
+void collect(
+    const std::filesystem::path& dir,
     const std::filesystem::path& from,
     const std::filesystem::path& to,
-    const Options& options,
-
-    const std::map<std::string, long>& times,
-    std::vector<CodeFile>& out_sources
+    const Snapshot& from_snapshot,
+    const Snapshot& to_snapshot,
+    std::vector<SyncItem>& out_items
 ) {
-    for (const auto &[name, is_dir] : read_dir(from)) {
+    for (const auto &[name, is_dir] : from_snapshot.children(dir)) {
         if (is_dir) {
-            sync(dir / name, from / name, to / name, options, times, out_sources);
+            if (!to_snapshot.is_dir(dir / name))
+                mkdirp(to / name);
+            collect(dir / name, from / name, to / name, from_snapshot, to_snapshot, out_items);
             continue;
         }
-        if (name == ".DS_Store")
-            continue;
-        if (dir.empty() && name == "sources.cmake")
+        if (!is_input(dir, name))
             continue;
 
-        auto path = dir / name;
-        auto ex = ext(name);
-        if (ex != "hpp" && ex != "h") {
-            if (!exists(to / name) || !options.incremental || get_last_modified(times, path) != get_last_modified(from / name)) {
-                if (exists(to / name))
-                    unlink(to / name);
-                copy(from / name, to / name);
+        out_items.push_back({ dir, name, from, to, from_snapshot.stat(dir / name)->size });
+    }
+}
+
+std::mutex log_mutex;
+
+// `write_file`, in a batch with io_uring when the sync has a writer
+void write_output(const SyncContext& context, const std::string& path, std::string content) {
+#ifdef __linux__
+    if (context.writer) {
+        context.writer->write(path, std::move(content));
+        return;
+    }
+#endif
+    write_file(path, content);
+}
+
+SyncResult sync_item(const SyncItem& item, const SyncContext& context) {
+    const auto &[dir, name, from, to, size] = item;
+    const auto &[options, state, cache, extract_dir, copy_mode, io_uring, from_snapshot, to_snapshot, prefetcher, writer, included, map_inputs] = context;
+    SyncResult result;
+    auto& out_sources = result.sources;
+
+    auto in_from = [&](const std::string& file) {
+        return from_snapshot ? from_snapshot->contains(dir / file) : exists(from / file);
+    };
+    auto in_to = [&](const std::string& file) {
+        return to_snapshot ? to_snapshot->contains(dir / file) : exists(to / file);
+    };
+
+    auto path = dir / name;
+    auto stat = from_snapshot ? from_snapshot->stat(path) : stat_file(from / name);
+    if (!stat) return result;
+
+    // the input is read (or mapped) at most once, whether it's needed for hashing, copying or generating
+    std::optional<MappedFile> code;
+    bool opened = false;
+    auto content = [&]() -> std::optional<std::string_view> {
+        if (!opened) {
+#ifdef __linux__
+            if (auto prefetched = prefetcher ? prefetcher->take(from / name) : std::nullopt) {
+                code = MappedFile::of(std::move(*prefetched));
+            } else
+#endif
+            code = MappedFile::open(from / name, map_inputs);
+            opened = true;
+        }
+        if (!code) return std::nullopt;
+        return code->view();
+    };
+    auto content_hash = [&]() -> std::optional<uint64_t> {
+        if (!content()) return std::nullopt;
+        return hash64(*content());
+    };
+    // without -i `state` is empty, nothing is unchanged
+    auto previous = state.unchanged(path, *stat, content_hash);
+    auto record = [&]() {
+        if (previous) {
+            result.state = previous;
+        } else if (auto hash = content_hash()) {
+            result.state = StateEntry{ *hash, *stat };
+        }
+    };
+
+    auto ex = ext(name);
+    if (ex != "hpp" && ex != "h") {
+        bool copied = false;
+        if (!in_to(name) || !previous) {
+            copied = copy_if_changed(from / name, to / name, copy_mode);
+        }
+        record();
+
+        if ((ex == "c" || ex == "cc" || ex == "cpp") && (copied || in_to(name))) {
+            out_sources.push_back({ true, false, "", path });
+        }
+    } else {
+        auto h_name = filename(name) + ".hpp";
+        auto c_name = filename(name) + ".cpp";
+        auto h_file = to / h_name;
+        auto c_file = to / c_name;
+
+        if (in_from(c_name) || in_from(filename(name) + ".c") || in_from(filename(name) + ".cc")) {
+            // don't generate, source file is already in `from` folder
+            if (!in_to(c_name) || !in_to(h_name) || !previous) {
+                copy_if_changed(from / name, h_file, copy_mode);
+                out_sources.push_back({ false, false, path, h_file });
             }
+            record();
+            return result;
+        }
+
+        if (!in_to(c_name) || !in_to(h_name) || !previous) {
+            if (!content()) return result;
+
+            auto line_path = options.reproducible ? lexically_relative(from / name, to) : std::filesystem::relative(from / name, to).string();
+            std::pair<std::string, std::string> output_path = {
+                (dir / (filename(name) + ".hpp")).generic_string(),
+                (dir / (filename(name) + ".cpp")).generic_string()
+            };
 
-            if ((ex == "c" || ex == "cc" || ex == "cpp") && exists(to / name)) {
-                auto last_modified = get_last_modified(from / name);
-                out_sources.push_back({ true, false, "", path, last_modified });
+            // includes are found from the header's own directory
+            auto render_options = options;
+            if (included) {
+                render_options.forward_declare = included->resolver(dir);
+            }
+
+            uint64_t cache_key = 0;
+            if (cache) {
+                auto key = to_hex(options_hash(options)) + "\n" + line_path + "\n" + output_path.first + "\n" + output_path.second;
+                if (included) key += "\n" + to_hex(included->dependencies_hash(dir, std::string(content().value())));
+                cache_key = GenerationCache::key(content().value(), key);
+                if (cache->restore(cache_key, h_file, c_file)) {
+                    {
+                        std::lock_guard lock(log_mutex);
+                        std::cout << "Restore [" << output_path.first << ", " << output_path.second << "] from cache" << std::endl;
+                    }
+                    out_sources.push_back({ true, true, path, c_file });
+                    out_sources.push_back({ false, true, path, h_file });
+                    record();
+                    return result;
+                }
             }
+
+            {
+                std::lock_guard lock(log_mutex);
+                std::cout << "Generate [" << (dir / (filename(name) + ".hpp")) << ", " << (dir / (filename(name) + ".cpp")) << "] from [" << path << "]" << std::endl;
+            }
+            auto extraction = load_extraction(context, content().value(), name, line_path, result.without_clang);
+            result.generated = true;
+            auto [h, c] = render(content().value(), extraction, line_path, output_path, render_options);
+            if (options.prune_includes) {
+                if (auto moved = prunedIncludes(content().value(), extraction); !moved.empty()) {
+                    std::string list;
+                    for (const auto& header : moved) list += (list.empty() ? "<" : ", <") + header + ">";
+                    auto size = preprocessed_size(moved);
+                    std::lock_guard lock(log_mutex);
+                    std::cout << "Move [" << list << "] from " << output_path.first << " to " << output_path.second;
+                    if (size) std::cout << ", up to " << (*size / 1024) << " KB less to preprocess for every includer";
+                    std::cout << std::endl;
+                }
+            }
+            if (render_options.forward_declare) {
+                for (const auto &[include, classes] : forwardDeclaredIncludes(content().value(), extraction, render_options.forward_declare)) {
+                    std::string list;
+                    for (const auto& name : classes) list += (list.empty() ? "" : ", ") + name;
+                    std::lock_guard lock(log_mutex);
+                    if (list.empty()) {
+                        // nothing from it is used in the header at all
+                        std::cout << "Move [\"" << include << "\"] from " << output_path.first << " to " << output_path.second << std::endl;
+                    } else {
+                        std::cout << "Forward declare [" << list << "] instead of including \"" << include << "\" in " << output_path.first << std::endl;
+                    }
+                }
+            }
+            if (cache) {
+                cache->store(cache_key, h, c);
+            }
+            write_output(context, c_file, std::move(c));
+            out_sources.push_back({ true, true, path, c_file });
+            write_output(context, h_file, std::move(h));
+            out_sources.push_back({ false, true, path, h_file });
         } else {
-            auto last_modified = get_last_modified(from / name);
-            auto h_file = to / (filename(name) + ".hpp");
-            auto c_file = to / (filename(name) + ".cpp");
-
-            auto c_file_from = from / (filename(name) + ".cpp");
-            if (!exists(c_file_from)) c_file_from = from / (filename(name) + ".c");
-            if (!exists(c_file_from)) c_file_from = from / (filename(name) + ".cc");
-            if (exists(c_file_from)) {
-                // don't generate, source file is already in `from` folder
-                if (!exists(c_file) || !exists(h_file) || !options.incremental || get_last_modified(times, path) != last_modified) {
-                    if (exists(h_file)) unlink(h_file);
-                    copy(from / name, h_file);
-                    out_sources.push_back({ false, false, path, h_file, last_modified });
+            out_sources.push_back({ true, true, path, c_file });
+            out_sources.push_back({ false, true, path, h_file });
+        }
+        record();
+    }
+    return result;
+}
+
+// Results by input path; ordered the same way as the directory walk
+using SyncResults = std::map<std::filesystem::path, SyncResult>;
+
+// Every decision is made from the snapshots of both trees, instead of asking the file system once per file
+SyncResults sync(
+    const std::filesystem::path& from,
+    const std::filesystem::path& to,
+    const Snapshot& from_snapshot,
+    const Snapshot& to_snapshot,
+    unsigned jobs,
+    const SyncContext& context
+) {
+    std::vector<SyncItem> items;
+    collect("", from, to, from_snapshot, to_snapshot, items);
+
+    auto run_context = context;
+    run_context.from_snapshot = &from_snapshot;
+    run_context.to_snapshot = &to_snapshot;
+
+    std::vector<size_t> order(items.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    if (jobs > 1) {
+        // largest files first, so a huge header doesn't end up being the last one processed
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return items[a].size > items[b].size;
+        });
+    }
+
+#ifdef __linux__
+    // inputs are read in the order they are processed; with -i, only those that are going to be read at all
+    std::optional<Prefetcher> prefetcher;
+    if (context.io_uring) {
+        std::vector<Prefetcher::File> files;
+        for (auto i : order) {
+            auto path = items[i].dir / items[i].name;
+            auto stat = from_snapshot.stat(path);
+            auto previous = context.state.entries.find(path);
+            if (stat && previous != context.state.entries.end() && previous->second.stat == *stat) continue;
+            files.push_back({ items[i].from / items[i].name, items[i].size });
+        }
+        prefetcher.emplace(std::move(files));
+        if (prefetcher->active()) {
+            run_context.prefetcher = &*prefetcher;
+        }
+    }
+    std::optional<BatchedWriter> writer;
+    if (context.io_uring) {
+        writer.emplace();
+        if (writer->active()) {
+            run_context.writer = &*writer;
+        }
+    }
+#endif
+    std::vector<SyncResult> results(items.size());
+    auto run = [&](size_t i) {
+        results[i] = sync_item(items[i], run_context);
+#ifdef __linux__
+        if (run_context.prefetcher) run_context.prefetcher->release(items[i].from / items[i].name);
+#endif
+    };
+
+    if (jobs <= 1) {
+        for (auto i : order) run(i);
+    } else {
+        WorkStealingPool pool(jobs);
+        pool.run(order, run);
+    }
+#ifdef __linux__
+    if (run_context.writer) run_context.writer->flush();
+#endif
+
+    SyncResults by_path;
+    for (size_t i = 0; i < items.size(); i++) {
+        by_path[items[i].dir / items[i].name] = std::move(results[i]);
+    }
+    return by_path;
+}
+
+// Merged in path order, so `sources.cmake` doesn't depend on scheduling
+void merge(const SyncResults& results, State& out_state, std::vector<CodeFile>& out_sources) {
+    for (const auto &[path, result] : results) {
+        out_sources.insert(out_sources.end(), result.sources.begin(), result.sources.end());
+        if (result.state) {
+            out_state.entries[path] = *result.state;
+        }
+    }
+}
+
+// How many headers were generated, and how many of them had nothing for clang to look at
+void report(const SyncResults& results) {
+    size_t generated = 0, without_clang = 0;
+    for (const auto &[path, result] : results) {
+        generated += result.generated;
+        without_clang += result.without_clang;
+    }
+    if (generated > 0) {
+        std::cout << "Generated " << generated << " header(s), " << without_clang << " without clang (nothing to extract)" << std::endl;
+    }
+}
+
+std::optional<std::filesystem::path> companion_source(const std::filesystem::path& from, const std::filesystem::path& header) {
+    for (const auto* ex : { ".cpp", ".c", ".cc" }) {
+        auto source = from / header.parent_path() / (filename(header.filename()) + ex);
+        if (exists(source)) return source;
+    }
+    return std::nullopt;
+}
+
+void remove_outputs(const std::filesystem::path& from, const std::filesystem::path& to, const std::filesystem::path& path) {
+    auto ex = ext(path.filename());
+    if (ex != "hpp" && ex != "h") {
+        unlink(to / path);
+        return;
+    }
+    auto stem = path.parent_path() / filename(path.filename());
+    unlink(to / (stem.string() + ".hpp"));
+    if (!companion_source(from, path)) {
+        unlink(to / (stem.string() + ".cpp"));
+    }
+}
+
+// What `path` turns into in `to`, relative to both
+std::vector<std::filesystem::path> outputs_of(const std::filesystem::path& path) {
+    auto ex = ext(path.filename());
+    if (ex != "hpp" && ex != "h") return { path };
+    auto stem = path.parent_path() / filename(path.filename());
+    return { stem.string() + ".hpp", stem.string() + ".cpp" };
+}
+
+// Removes outputs of inputs that were synced last time but aren't in `from` anymore,
+// unless an input that is still there has the same output (`a.h` after `a.hpp`, a header's own source)
+void prune_outputs(const std::filesystem::path& from, const std::filesystem::path& to, const State& previous, const SyncResults& results) {
+    std::set<std::filesystem::path> live;
+    for (const auto &[path, result] : results) {
+        for (auto& output : outputs_of(path)) live.insert(std::move(output));
+    }
+    for (const auto &[input, entry] : previous.entries) {
+        if (results.contains(input)) continue;
+        for (const auto& output : outputs_of(input)) {
+            if (live.contains(output) || !exists(to / output)) continue;
+            std::cout << "Remove " << output << " of deleted [" << input << "]" << std::endl;
+            unlink(to / output);
+
+            // directories that were only there for deleted inputs go too
+            std::error_code error;
+            for (auto dir = output.parent_path(); !dir.empty(); dir = dir.parent_path()) {
+                if (exists(from / dir) || !std::filesystem::is_empty(to / dir, error) || error) break;
+                std::filesystem::remove(to / dir, error);
+            }
+        }
+    }
+}
+
+bool is_header(const std::filesystem::path& path) {
+    auto ex = ext(path.filename());
+    return ex == "hpp" || ex == "h";
+}
+
+// With forward declarations, outputs of a header depend on the headers it includes. When any header was added, changed
+// or deleted since `state`, headers are all rendered again (extractions are kept, unchanged outputs aren't written)
+void forget_headers_if_changed(const Snapshot& from_snapshot, State& state) {
+    // headers now and when `state` was recorded, with their stats
+    std::map<std::string, FileStat> headers, recorded;
+    for (const auto &[dir, stat] : from_snapshot.directories()) {
+        for (const auto &[name, is_dir] : from_snapshot.children(dir)) {
+            auto path = std::filesystem::path(dir) / name;
+            if (!is_dir && is_header(path)) headers.emplace(path.string(), *from_snapshot.stat(path));
+        }
+    }
+    for (const auto &[path, entry] : state.entries) {
+        if (is_header(path)) recorded.emplace(path, entry.stat);
+    }
+    if (headers == recorded) return;
+    std::erase_if(state.entries, [](const auto& entry) { return is_header(entry.first); });
+}
+
+// Directories of both trees, for the no-op check of the next run. A tree is only recorded when all of its
+// directories are `settled`, `to` is stat'ed again since outputs were just written into it
+void record_dirs(const std::filesystem::path& to, const Snapshot& from_snapshot, State& out_state) {
+    auto from_dirs = from_snapshot.directories();
+    for (const auto &[path, stat] : from_dirs) {
+        if (!State::settled(stat, from_snapshot.scanned_ns)) return;
+    }
+    auto now = now_ns();
+    std::map<std::string, FileStat> to_dirs;
+    for (const auto &[path, stat] : from_dirs) {
+        // `to` itself changes with every state file written there, outputs directly in it are checked one by one
+        if (path.empty()) continue;
+        auto to_stat = stat_file(to / path);
+        if (!to_stat || !State::settled(*to_stat, now)) return;
+        to_dirs[path] = *to_stat;
+    }
+    out_state.from_dirs = std::move(from_dirs);
+    out_state.to_dirs = std::move(to_dirs);
+}
+
+// parse costs of headers measured by previous runs, since they take a compiler run each
+constexpr const char* PCH_COSTS_FILE = ".headless-pch-costs";
+
+// Writes `headless_pch.hpp` with the system and third-party headers (`#include <...>` that isn't in `from`)
+// that the C++ sources in `sources` include most often, directly or through project headers, and that are slow to parse.
+// `pch.cmake` next to it adds it to a target
+void write_pch(const std::filesystem::path& from, const std::filesystem::path& to, const std::vector<CodeFile>& sources) {
+    std::map<std::string, std::optional<FileIncludes>> includes;
+    auto includes_of = [&](const std::filesystem::path& path) -> const std::optional<FileIncludes>& {
+        auto it = includes.find(path.generic_string());
+        if (it != includes.end()) return it->second;
+        std::optional<FileIncludes> found;
+        if (auto code = read_file(from / path)) found = unconditionalIncludes(code.value());
+        return includes.emplace(path.generic_string(), std::move(found)).first->second;
+    };
+    auto in_from = [&](const std::filesystem::path& path) {
+        return !path.empty() && *path.begin() != ".." && std::filesystem::is_regular_file(from / path);
+    };
+
+    std::map<std::string, size_t> included_by;
+    size_t units = 0;
+    for (const auto &[is_source, generated, input, output] : sources) {
+        auto unit = std::filesystem::path(input.empty() ? output : input);
+        if (!is_source || ext(unit.filename()) == "c") continue;
+        units++;
+
+        std::set<std::string> visited = { unit.generic_string() }, angled;
+        std::vector<std::filesystem::path> queue = { unit };
+        for (size_t i = 0; i < queue.size(); i++) {
+            const auto& file = includes_of(queue[i]);
+            if (!file) continue;
+            auto dir = queue[i].parent_path();
+            auto follow = [&](const std::filesystem::path& path) {
+                if (visited.insert(path.generic_string()).second) queue.push_back(path);
+            };
+            for (const auto& include : file->quoted) {
+                auto next_to = (dir / include).lexically_normal();
+                auto from_root = std::filesystem::path(include).lexically_normal();
+                if (in_from(next_to)) follow(next_to);
+                else if (in_from(from_root)) follow(from_root);
+            }
+            for (const auto& include : file->angled) {
+                // a project header, changes as often as the project does
+                auto from_root = std::filesystem::path(include).lexically_normal();
+                if (in_from(from_root)) follow(from_root);
+                else angled.insert(include);
+            }
+        }
+        for (const auto& header : angled) included_by[header]++;
+    }
+
+    // `<header>\t<ms>` lines after the compiler command they were measured with, `-` for headers that didn't compile
+    const char* cxx = std::getenv("CXX");
+    const char* flags = std::getenv("CXXFLAGS");
+    auto compiler = std::string(cxx ? cxx : "c++") + " " + (flags ? flags : "");
+    std::map<std::string, std::optional<double>> costs;
+    if (auto content = read_file(to / PCH_COSTS_FILE)) {
+        std::stringstream s(content.value());
+        std::string line;
+        if (std::getline(s, line) && line == compiler) {
+            while (std::getline(s, line)) {
+                auto tab = line.find('\t');
+                if (tab == std::string::npos) continue;
+                auto cost = line.substr(tab + 1);
+                costs[line.substr(0, tab)] = cost == "-" ? std::nullopt : std::optional(std::strtod(cost.c_str(), nullptr));
+            }
+        }
+    }
+
+    std::vector<PchCandidate> candidates;
+    for (const auto &[header, count] : included_by) {
+        if (!includedOftenEnough(count, units)) continue;
+        if (!costs.contains(header)) costs[header] = parse_cost_ms(header);
+        if (auto cost = costs[header]) candidates.push_back({ header, count, *cost });
+    }
+    std::stringstream s;
+    s << compiler << "\n";
+    for (const auto &[header, cost] : costs) {
+        s << header << "\t" << (cost ? std::to_string(*cost) : "-") << "\n";
+    }
+    write_file(to / PCH_COSTS_FILE, s.str());
+
+    // reported when the choice changes, like outputs are when they are generated
+    auto chosen = choosePch(std::move(candidates), units);
+    if (write_file(to / PCH_FILE, writePch(chosen))) {
+        for (const auto& candidate : chosen) {
+            std::cout << "Precompile <" << candidate.header << ">: included by " << candidate.units << " of " << units
+                      << " sources, " << static_cast<int>(candidate.cost_ms) << " ms to parse" << std::endl;
+        }
+    }
+    write_file(to / PCH_CMAKE_FILE, writePchCmake());
+}
+
+// The whole of an incremental run when nothing changed: no directory in either tree has a new mtime,
+// so no file was added, removed or renamed, and every input has the same stats it was synced with.
+// Goes over the state file as it is, and doesn't list any directory
+bool nothing_changed(
+    const std::filesystem::path& from,
+    const std::filesystem::path& to,
+    std::string_view state,
+    uint64_t options_hash,
+    bool generate_sources,
+    bool pch
+) {
+    int from_fd = open(from.c_str(), O_RDONLY | O_DIRECTORY);
+    int to_fd = open(to.c_str(), O_RDONLY | O_DIRECTORY);
+    std::string path;
+    auto same = [&](int fd, std::string_view relative, const FileStat& expected) {
+        path.assign(relative.empty() ? "." : relative);
+        struct stat st;
+        return fstatat(fd, path.c_str(), &st, 0) == 0 && to_file_stat(st) == expected;
+    };
+    auto present = [](int fd, const std::string& relative) {
+        struct stat st;
+        return fstatat(fd, relative.c_str(), &st, 0) == 0;
+    };
+
+    uint64_t previous_hash = 0;
+    bool has_dirs = false;
+    bool unchanged = from_fd >= 0 && to_fd >= 0 && State::visit(state, previous_hash, [&](const State::Line& line) {
+        if (previous_hash != options_hash) return false;
+        if (line.tree == "from") {
+            has_dirs = true;
+            return same(from_fd, line.path, line.stat);
+        }
+        if (line.tree == "to") return same(to_fd, line.path, line.stat);
+
+        // directories come first, without them there's no telling whether files were added
+        if (!has_dirs || !same(from_fd, line.path, line.stat)) return false;
+        // `to` itself isn't recorded, since every state file written there changes it
+        if (line.path.find(separator) == std::string_view::npos) {
+            for (const auto& output : outputs_of(std::string(line.path))) {
+                if (!present(to_fd, output)) return false;
+            }
+        }
+        return true;
+    });
+    unchanged = unchanged && has_dirs && (!generate_sources || present(to_fd, "sources.cmake"))
+        && (!pch || (present(to_fd, PCH_FILE) && present(to_fd, PCH_CMAKE_FILE)));
+
+    if (from_fd >= 0) close(from_fd);
+    if (to_fd >= 0) close(to_fd);
+    return unchanged;
+}
+
+#ifdef __linux__
+// Keeps `to` in sync with changes in `from` until the process is stopped
+void watch(
+    const std::filesystem::path& from,
+    const std::filesystem::path& to,
+    const SyncContext& context,
+    SyncResults results,
+    bool generate_sources,
+    bool pch
+) {
+    Watcher watcher(from);
+    if (!watcher.valid()) {
+        std::cerr << "headless: Can't watch \"" << from << "\"" << std::endl;
+        return;
+    }
+    std::cout << "Watching " << from << " for changes" << std::endl;
+
+    // only actually changed content is regenerated, as with -i: the state of the last sync is always compared against.
+    // Editors like to save files as they are
+    const auto& options = context.options;
+    auto state = context.state;
+
+    while (true) {
+        auto [changed, removed] = watcher.wait();
+
+        for (const auto& path : removed) {
+            for (auto it = results.begin(); it != results.end();) {
+                auto relative = it->first.lexically_relative(path);
+                if (relative.empty() || *relative.begin() == "..") {
+                    ++it;
+                    continue;
+                }
+                remove_outputs(from, to, it->first);
+                it = results.erase(it);
+            }
+        }
+
+        // a header is copied instead of generated when it has its own source, so it follows that source
+        for (const auto& path : std::set(changed.begin(), changed.end())) {
+            auto ex = ext(path.filename());
+            if (ex != "c" && ex != "cc" && ex != "cpp") continue;
+            for (const auto* header_ex : { ".hpp", ".h" }) {
+                auto header = path.parent_path() / (filename(path.filename()) + header_ex);
+                if (exists(from / header)) changed.insert(header);
+            }
+        }
+        for (const auto& path : removed) {
+            auto ex = ext(path.filename());
+            if (ex != "c" && ex != "cc" && ex != "cpp") continue;
+            for (const auto* header_ex : { ".hpp", ".h" }) {
+                auto header = path.parent_path() / (filename(path.filename()) + header_ex);
+                if (exists(from / header)) {
+                    changed.insert(header);
+                    state.entries.erase(header);
                 }
-                continue;
             }
+        }
 
-            if (!exists(c_file) || !exists(h_file) || !options.incremental || get_last_modified(times, path) != last_modified) {
-                auto code = read_file(from / name);
+        // with forward declarations, a header's outputs depend on the headers it includes
+        if (context.included) {
+            context.included->clear();
+            bool header_changed = std::any_of(changed.begin(), changed.end(), is_header) || std::any_of(removed.begin(), removed.end(), is_header);
+            for (const auto &[path, result] : results) {
+                if (!header_changed || !is_header(path)) continue;
+                changed.insert(path);
+                state.entries.erase(path);
+            }
+        }
+
+        for (const auto& path : changed) {
+            if (!is_input(path.parent_path(), path.filename()) || !std::filesystem::is_regular_file(from / path)) continue;
+            if (!exists(to / path.parent_path())) mkdirp(to / path.parent_path());
+
+            // the file can be gone again by now, it is then among the removed ones next time
+            std::error_code ec;
+            auto size = std::filesystem::file_size(from / path, ec);
+            if (ec) continue;
+            SyncItem item = { path.parent_path(), path.filename(), from / path.parent_path(), to / path.parent_path(), size };
+            results[path] = sync_item(item, {
+                .options = options,
+                .state = state,
+                .cache = context.cache,
+                .extract_dir = context.extract_dir,
+                .copy_mode = context.copy_mode,
+                .included = context.included,
+                .map_inputs = false,
+            });
+        }
+
+        State new_state;
+        new_state.options_hash = state.options_hash;
+        std::vector<CodeFile> sources;
+        merge(results, new_state, sources);
+        state = std::move(new_state);
+        prune_extractions(context.extract_dir, state, options.engine);
+
+        write_file(to / State::FILE_NAME, state.serialize());
+        if (generate_sources) {
+            write_file(to / "sources.cmake", write_sources(sources));
+        }
+        if (pch) {
+            write_pch(from, to, sources);
+        }
+    }
+}
+#endif
+
+void collect_headers(const std::filesystem::path& dir, std::vector<std::filesystem::path>& out_headers) {
+    for (const auto &[name, is_dir] : read_dir(dir)) {
+        if (is_dir) {
+            collect_headers(dir / name, out_headers);
+        } else if (ext(name) == "hpp" || ext(name) == "h") {
+            out_headers.push_back(dir / name);
+        }
+    }
+}
+
+// Measures the prepass throughput and how long clang takes per header in `dir`: started over for every file,
+// reused between files, and skipped for headers with nothing to extract
+void bench(const std::filesystem::path& dir) {
+    std::vector<std::filesystem::path> headers;
+    collect_headers(dir, headers);
+    std::vector<std::string> codes;
+    for (const auto& header : headers) {
+        codes.push_back(read_file(header).value_or(""));
+    }
+    if (codes.empty()) {
+        std::cerr << "headless: No headers in \"" << dir.string() << "\"" << std::endl;
+        return;
+    }
+
+    const int rounds = 5;
+
+    // the prepass runs for every header, with either engine
+    size_t bytes = 0;
+    for (const auto& code : codes) bytes += code.size();
+    auto prepassStart = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        for (const auto& code : codes) parseIfDefs(code);
+    }
+    std::chrono::duration<double> prepass = std::chrono::steady_clock::now() - prepassStart;
+
+    auto measure = [&](const std::function<void(const std::string&, const std::string&)>& fn) {
+        auto start = std::chrono::steady_clock::now();
+        for (int round = 0; round < rounds; round++) {
+            for (size_t i = 0; i < codes.size(); i++) {
+                fn(codes[i], headers[i].string());
+            }
+        }
+        std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+        return duration.count() / (rounds * codes.size());
+    };
+
+    auto separate = measure([](const std::string& code, const std::string& path) {
+        ExtractSession session;
+        session.extract(code, path);
+    });
+    ExtractSession session;
+    auto reused = measure([&](const std::string& code, const std::string& path) { session.extract(code, path); });
+    ExtractSession prescanning;
+    prescanning.prescan = true;
+    auto prescanned = measure([&](const std::string& code, const std::string& path) { prescanning.extract(code, path); });
+
+    std::cout << codes.size() << " headers, " << rounds << " rounds" << std::endl;
+    std::cout << "Prepass (comments, literals, #if): " << (bytes * rounds / prepass.count() / 1e9) << " GB/s" << std::endl;
+    std::cout << "New clang state for every file:   " << separate << " ms/file" << std::endl;
+    std::cout << "Clang state reused between files: " << reused << " ms/file, "
+        << (separate - reused) << " ms/file (" << static_cast<int>(100 * (separate - reused) / separate) << "%) saved" << std::endl;
+    std::cout << "Skipping clang when nothing to extract: " << prescanned << " ms/file, "
+        << prescanning.withoutClang / rounds << " of " << codes.size() << " headers without clang" << std::endl;
+}
+
+#ifdef __linux__
+// Reads every file in `dir` the way sync does (and runs the prepass over headers, as work to overlap with),
+// with blocking reads and with the io_uring prefetcher. Files are dropped from the page cache before each round.
+// Then writes all of them to a temporary directory, one by one and in io_uring batches, starting from an empty one
+void bench_io(const std::filesystem::path& dir) {
+    std::vector<Prefetcher::File> files;
+    uint64_t bytes = 0;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(dir)) {
+        if (!entry.is_regular_file()) continue;
+        files.push_back({ entry.path().string(), entry.file_size() });
+        bytes += entry.file_size();
+    }
+    if (files.empty()) {
+        std::cerr << "headless: No files in \"" << dir.string() << "\"" << std::endl;
+        return;
+    }
+
+    auto evict = [&]() {
+        for (const auto& file : files) {
+            int fd = open(file.path.c_str(), O_RDONLY);
+            if (fd < 0) continue;
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+    };
+
+    const int rounds = 3;
+    uint64_t checksum = 0;
+    auto measure = [&](bool uring) {
+        double total = 0;
+        for (int round = 0; round < rounds; round++) {
+            evict();
+            auto start = std::chrono::steady_clock::now();
+            std::optional<Prefetcher> prefetcher;
+            if (uring) prefetcher.emplace(files);
+            for (const auto& file : files) {
+                std::optional<MappedFile> code;
+                if (prefetcher) {
+                    if (auto prefetched = prefetcher->take(file.path)) code = MappedFile::of(std::move(*prefetched));
+                }
+                if (!code) code = MappedFile::open(file.path);
                 if (!code) continue;
+                checksum += hash64(code->view());
+                auto ex = ext(std::filesystem::path(file.path).filename());
+                if (ex == "hpp" || ex == "h") checksum += parseIfDefs(code->view()).second.size();
+            }
+            std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+            total += duration.count();
+        }
+        return total / rounds;
+    };
 
-                std::cout << "Generate [" << (dir / (filename(name) + ".hpp")) << ", " << (dir / (filename(name) + ".cpp")) << "] from [" << path << "]; cachedTime=" << get_last_modified(times, path) << ", time=" << last_modified << std::endl;
-                auto [h, c] = process(
-                    code.value(),
-                    std::filesystem::relative(from / name, to),
-                    { dir / (filename(name) + ".hpp"), dir / (filename(name) + ".cpp") },
-                    options
-                );
-                auto last_modified = get_last_modified(from / name);
-                write_file(c_file, c);
-                out_sources.push_back({ true, true, path, c_file, last_modified });
-                write_file(h_file, h);
-                out_sources.push_back({ false, true, path, h_file, last_modified });
-            } else {
-                out_sources.push_back({ true, true, path, c_file, last_modified });
-                out_sources.push_back({ false, true, path, h_file, last_modified });
+    auto blocking = measure(false);
+    std::cout << files.size() << " files, " << (bytes / 1024 / 1024) << " MB, cold page cache, " << rounds << " rounds" << std::endl;
+    std::cout << "Blocking reads:    " << blocking << " ms" << std::endl;
+    if (!Prefetcher({}).active()) {
+        std::cout << "io_uring:          not available" << std::endl;
+        return;
+    }
+    auto uring = measure(true);
+    std::cout << "io_uring prefetch: " << uring << " ms" << std::endl;
+
+    std::vector<std::string> contents;
+    for (const auto& file : files) {
+        contents.push_back(read_file(file.path).value_or(""));
+    }
+    auto out = std::filesystem::temp_directory_path() / ("headless-bench-io-" + std::to_string(getpid()));
+    auto measure_writes = [&](bool uring) {
+        double total = 0;
+        for (int round = 0; round < rounds; round++) {
+            std::filesystem::remove_all(out);
+            mkdirp(out);
+            auto start = std::chrono::steady_clock::now();
+            std::optional<BatchedWriter> writer;
+            if (uring) writer.emplace();
+            for (size_t i = 0; i < contents.size(); i++) {
+                auto path = (out / std::to_string(i)).string();
+                if (writer) {
+                    writer->write(path, contents[i]);
+                } else {
+                    write_file(path, contents[i]);
+                }
             }
+            if (writer) writer->flush();
+            std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+            total += duration.count();
         }
+        std::filesystem::remove_all(out);
+        return total / rounds;
+    };
+    std::cout << "Blocking writes:   " << measure_writes(false) << " ms" << std::endl;
+    std::cout << "io_uring batches:  " << measure_writes(true) << " ms" << std::endl;
+}
+#endif
+
+#ifdef __linux__
+// Runs `command` with its output dropped, returns its exit code
+int run_quietly(const std::vector<std::string>& command) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    std::vector<char*> argv;
+    for (const auto& arg : command) argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+
+    pid_t pid;
+    int error = posix_spawn(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (error != 0) return 1;
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return 1;
     }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+// Times incremental runs of this executable that have nothing to do, as the ones CMake starts on every build,
+// over a synthetic tree of 10k files in `dir`, against the 10 ms goal. The goal isn't met everywhere: such a run still
+// stats every input (an edit in place changes nothing else), so the time it takes just to stat them all is reported too.
+// Fails only when a run fails
+bool bench_noop(const std::filesystem::path& dir) {
+    const int dirs = 100, files_per_dir = 100, runs = 20;
+    const double limit_ms = 10;
+
+    auto from = dir / "src", to = dir / "gsrc";
+    if (!exists(from)) {
+        for (int d = 0; d < dirs; d++) {
+            auto sub = from / ("module" + std::to_string(d));
+            mkdirp(sub);
+            for (int f = 0; f < files_per_dir; f++) {
+                auto id = std::to_string(d) + "_" + std::to_string(f);
+                if (f < 70) {
+                    write_file(sub / ("header" + std::to_string(f) + ".hpp"),
+                        "#pragma once\n#include <string>\n\nstruct Type" + id + " {\n    int get() const { return " + std::to_string(f) + "; }\n};\n\n"
+                        "inline int twice" + id + "(int x) { return x * 2; }\nint next" + id + "(int x) { return x + 1; }\n");
+                } else if (f < 90) {
+                    write_file(sub / ("source" + std::to_string(f) + ".cpp"), "int value" + id + " = " + std::to_string(f) + ";\n");
+                } else {
+                    write_file(sub / ("data" + std::to_string(f) + ".txt"), "data " + id + "\n");
+                }
+            }
+        }
+    }
+
+    auto self = std::filesystem::read_symlink("/proc/self/exe").string();
+    std::vector<std::string> command = { self, "-iglw", "--engine=lexer", "-j0", "--from=" + from.string(), "--to=" + to.string() };
+
+    // the first run generates everything, the second one records directories once they have settled
+    for (int i = 0; i < 2; i++) {
+        if (run_quietly(command) != 0) {
+            std::cerr << "headless: Sync of \"" << from.string() << "\" failed" << std::endl;
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+
+    std::vector<double> times;
+    for (int i = 0; i < runs; i++) {
+        auto start = std::chrono::steady_clock::now();
+        if (run_quietly(command) != 0) return false;
+        std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+        times.push_back(duration.count());
+    }
+    std::sort(times.begin(), times.end());
+    auto median = times[times.size() / 2];
+
+    // the floor: one stat per recorded path, without starting a process or reading anything
+    auto state = read_file(to / State::FILE_NAME);
+    if (!state) return false;
+    int from_fd = open(from.c_str(), O_RDONLY | O_DIRECTORY);
+    auto start = std::chrono::steady_clock::now();
+    uint64_t hash;
+    std::string path;
+    State::visit(state.value(), hash, [&](const State::Line& line) {
+        path.assign(line.path.empty() ? "." : line.path);
+        struct stat st;
+        fstatat(from_fd, path.c_str(), &st, 0);
+        return true;
+    });
+    std::chrono::duration<double, std::milli> stats = std::chrono::steady_clock::now() - start;
+    if (from_fd >= 0) close(from_fd);
+
+    std::cout << dirs * files_per_dir << " files, " << runs << " no-op runs: median " << median << " ms, max " << times.back() << " ms"
+              << ", stats alone " << stats.count() << " ms" << std::endl;
+    if (median > limit_ms) {
+        std::cerr << "headless: Median is above the " << limit_ms << " ms goal" << std::endl;
+        return false;
+    }
+    return true;
+}
+#endif
+
+// First line where `a` and `b` differ
+std::string first_difference(const std::string& a, const std::string& b) {
+    std::stringstream sa(a), sb(b);
+    std::string la, lb;
+    for (long line = 1;; line++) {
+        bool ha = !!std::getline(sa, la), hb = !!std::getline(sb, lb);
+        if (!ha && !hb) return "";
+        if (!ha || !hb || la != lb) {
+            return "line " + std::to_string(line) + ": clang \"" + (ha ? la : "<end>") + "\", lexer \"" + (hb ? lb : "<end>") + "\"";
+        }
+    }
+}
+
+// Runs both engines over every header in `dir` and reports where the lexer engine doesn't match clang
+bool diff_engines(const std::filesystem::path& dir) {
+    std::vector<std::filesystem::path> headers;
+    collect_headers(dir, headers);
+
+    ExtractSession session;
+    // headers the prescan would keep from clang, and those of them where clang does find something
+    size_t same = 0, fallbacks = 0, differences = 0, skipped = 0, wrongly_skipped = 0;
+    for (const auto& header : headers) {
+        auto code = read_file(header);
+        if (!code) continue;
+        auto lexer = extractWithLexer(code.value());
+        if (!lexer) {
+            fallbacks++;
+            std::cout << "Clang only: " << header.string() << std::endl;
+            continue;
+        }
+        auto clang = session.extract(code.value(), header.string());
+        if (lexer->fragments.empty() && lexer->replacements.empty()) {
+            skipped++;
+            if (!clang.fragments.empty() || !clang.replacements.empty()) {
+                wrongly_skipped++;
+                std::cout << "Prescan would skip clang, but clang extracts: " << header.string() << std::endl;
+            }
+        }
+        if (serializeExtraction(clang) == serializeExtraction(lexer.value())) {
+            same++;
+            continue;
+        }
+
+        differences++;
+        std::cout << "Differs:    " << header.string() << std::endl;
+        Options options;
+        options.add_lines = true;
+        std::pair<std::string, std::string> output_path = { "out.hpp", "out.cpp" };
+        auto [clang_h, clang_c] = render(code.value(), clang, header.string(), output_path, options);
+        auto [lexer_h, lexer_c] = render(code.value(), lexer.value(), header.string(), output_path, options);
+        if (clang_h != lexer_h) std::cout << "  .hpp " << first_difference(clang_h, lexer_h) << std::endl;
+        if (clang_c != lexer_c) std::cout << "  .cpp " << first_difference(clang_c, lexer_c) << std::endl;
+    }
+    std::cout << headers.size() << " headers: " << same << " same, " << fallbacks << " left to clang, " << differences << " different" << std::endl;
+    std::cout << "Prescan: " << skipped << " headers without clang, " << wrongly_skipped << " of them wrongly" << std::endl;
+    return differences == 0 && wrongly_skipped == 0;
 }
 
 int main(int argc, char **argv) {
@@ -204,14 +1231,101 @@ int main(int argc, char **argv) {
         ("i", "Sync files incrementally (update only those that were changed). Forces -g")
         ("w,wrap", "Wrap headers around with #ifndef HEADER_XXX; #define HEADER_XXX; ... #endif")
         ("l,lines", "Add #line in outputs for debug")
+        ("r,reproducible", "Make outputs depend only on inputs: header guards from content hashes instead of random numbers, #line paths relative without resolving symlinks")
+        ("cache-dir", "Reuse outputs generated for the same inputs and options from this directory, can be shared between checkouts", cxxopts::value<std::string>())
+        ("cache-size", "Evict least recently used entries from --cache-dir above this size in MB (0 = no limit)", cxxopts::value<uint64_t>()->default_value("0"))
+        ("stable-lines", "With -l, keep headers byte-identical when only function bodies change (#line in headers stops at the first extracted definition)")
+        ("watch", "After syncing, keep running and sync files in `--from` as they change (Linux only)")
+        ("copy-mode", "How files other than headers get to `--to`: `auto` (reflink, otherwise copy in the kernel, otherwise copy), `reflink`, `hardlink`, `symlink` or `copy`", cxxopts::value<std::string>()->default_value("auto"))
+        ("prune-includes", "Move standard includes that only function bodies need from generated headers into generated sources")
+        ("forward-declare", "Replace project includes that generated headers need only for pointers and references with forward declarations, the includes go to generated sources")
+        ("pch", "Generate `headless_pch.hpp` with system and third-party headers that most sources include and that are slow to parse (measured with $CXX and $CXXFLAGS), and `pch.cmake` that adds it to a target with `headless_precompile_headers(target)`")
+        ("engine", "What finds definitions in headers: `clang`, or `lexer` that is faster, approximates clang and uses it only for headers it doesn't fully understand", cxxopts::value<std::string>()->default_value("clang"))
+        ("diff-engines", "Run both engines over headers in a directory and report where they disagree", cxxopts::value<std::string>())
+        ("bench", "Measure per-file clang time for headers in a directory, with and without reusing clang state between files", cxxopts::value<std::string>())
+        ("io", "How sync reads inputs and writes outputs: `sync`, or `uring` to read inputs ahead of the workers and write generated headers and sources in batches with io_uring (Linux only, falls back to `sync` where io_uring isn't available)", cxxopts::value<std::string>()->default_value("sync"))
+        ("bench-io", "Compare reading the files in a directory, and writing them elsewhere, with and without io_uring, on a cold page cache (Linux only)", cxxopts::value<std::string>())
+        ("bench-noop", "Time incremental runs with nothing to do against the 10 ms goal, on a synthetic tree of 10k files generated in this directory (Linux only)", cxxopts::value<std::string>())
+        ("j,jobs", "Process files with N threads (0 = number of cores)", cxxopts::value<unsigned>()->default_value("1"))
         ;
-    auto result = options.parse(argc, argv);
+
+    // `headless wrap [options] -- <compiler command>`, options go before `--`
+    std::optional<std::vector<std::string>> wrap_command;
+    std::vector<char*> args(argv, argv + argc);
+    if (argc > 1 && std::string(argv[1]) == "wrap") {
+        auto dash = std::find_if(args.begin(), args.end(), [](const char* arg) { return std::string(arg) == "--"; });
+        wrap_command = std::vector<std::string>(dash == args.end() ? dash : dash + 1, args.end());
+        args.erase(dash, args.end());
+        args.erase(args.begin() + 1);
+    }
+    auto result = options.parse(static_cast<int>(args.size()), args.data());
 
     if (result.count("help")) {
         std::cout << options.help() << std::endl;
         return 0;
     }
 
+    auto engine_name = result["engine"].as<std::string>();
+    if (engine_name != "clang" && engine_name != "lexer") {
+        std::cerr << "headless: Unknown engine \"" << engine_name << "\"" << std::endl;
+        return 1;
+    }
+    auto engine = engine_name == "lexer" ? Engine::Lexer : Engine::Clang;
+
+    auto copy_mode_name = result["copy-mode"].as<std::string>();
+    auto copy_mode_parsed = parse_copy_mode(copy_mode_name);
+    if (!copy_mode_parsed) {
+        std::cerr << "headless: Unknown copy mode \"" << copy_mode_name << "\"" << std::endl;
+        return 1;
+    }
+    auto copy_mode = copy_mode_parsed.value();
+
+    auto io = result["io"].as<std::string>();
+    if (io != "sync" && io != "uring") {
+        std::cerr << "headless: Unknown I/O backend \"" << io << "\"" << std::endl;
+        return 1;
+    }
+
+    if (wrap_command) {
+        Options wrap_options = {
+            .wrap_headers = result.count("wrap") > 0,
+            .wrap_headers_add_random = true,
+            .add_lines = result.count("lines") > 0,
+            .reproducible = result.count("reproducible") > 0,
+            .engine = engine,
+            .prune_includes = result.count("prune-includes") > 0
+        };
+        return wrap(wrap_options, wrap_command.value(), result.count("forward-declare") > 0);
+    }
+
+    if (result.count("diff-engines")) {
+        return diff_engines(result["diff-engines"].as<std::string>()) ? 0 : 1;
+    }
+
+    if (result.count("bench")) {
+        bench(result["bench"].as<std::string>());
+        return 0;
+    }
+
+    if (result.count("bench-io")) {
+#ifdef __linux__
+        bench_io(result["bench-io"].as<std::string>());
+        return 0;
+#else
+        std::cerr << "headless: --bench-io is only supported on Linux" << std::endl;
+        return 1;
+#endif
+    }
+
+    if (result.count("bench-noop")) {
+#ifdef __linux__
+        return bench_noop(result["bench-noop"].as<std::string>()) ? 0 : 1;
+#else
+        std::cerr << "headless: --bench-noop is only supported on Linux" << std::endl;
+        return 1;
+#endif
+    }
+
     if (result.count("test")) {
         bool had_fails = false;
         auto test_dir = std::filesystem::path(result["test"].as<std::string>());
@@ -229,14 +1343,31 @@ int main(int argc, char **argv) {
             if (!input || !expected_c || !expected_h) continue;
             std::cout << "Test \"" << test << "\": ";
 
-            auto add_lines = test == "lines";
-            auto wrap_headers = test == "wrap";
+            // compared byte for byte, the others only up to whitespace
+            auto exact = test == "lines_exact";
+            auto stable_lines = test == "lines_stable";
+            auto add_lines = test == "lines" || exact || stable_lines;
+            auto reproducible = test == "wrap_reproducible";
+            auto wrap_headers = test == "wrap" || reproducible;
+            auto prune_includes = test.starts_with("prune_includes");
+            IncludedHeaders included(test_dir / test);
+            auto forward_declare = test == "forward_declare" ? included.resolver("") : nullptr;
 
             auto start = millis();
-            auto [h, c] = process(input.value(), "input.hpp", { "expect.hpp", "expect.cpp" }, { wrap_headers, false, add_lines });
+            auto [h, c] = process(input.value(), "input.hpp", { "expect.hpp", "expect.cpp" }, {
+                .wrap_headers = wrap_headers,
+                .add_lines = add_lines,
+                .stable_lines = stable_lines,
+                .reproducible = reproducible,
+                .engine = engine,
+                .prune_includes = prune_includes,
+                .forward_declare = forward_declare
+            });
             auto duration = millis() - start;
 
-            bool success = escape(h) == escape(expected_h.value()) && escape(c) == escape(expected_c.value());
+            bool success = exact
+                ? h == expected_h.value() && c == expected_c.value()
+                : escape(h) == escape(expected_h.value()) && escape(c) == escape(expected_c.value());
             if (success) {
                 std::cout << "✅ Success (" << duration << "ms)" << std::endl;
             } else {
@@ -259,9 +1390,16 @@ int main(int argc, char **argv) {
     }
 
     auto add_lines = !!result.count("lines");
+    auto stable_lines = !!result.count("stable-lines");
+    auto reproducible = !!result.count("reproducible");
     auto wrap_headers = !!result.count("wrap");
     auto incremental = !!result.count("i");
+    auto prune_includes = !!result.count("prune-includes");
+    auto forward_declare = !!result.count("forward-declare");
     auto generate_sources = incremental || !!result.count("g");
+    auto pch = !!result.count("pch");
+    auto jobs = result["jobs"].as<unsigned>();
+    if (jobs == 0) jobs = std::max(1u, std::thread::hardware_concurrency());
     if (result.count("to") && result.count("from")) {
         auto from = std::filesystem::path(result["from"].as<std::string>());
         auto to = std::filesystem::path(result["to"].as<std::string>());
@@ -275,23 +1413,98 @@ int main(int argc, char **argv) {
             mkdirp(to);
         }
 
-        std::map<std::string, long> sources_times;
-        std::vector<CodeFile> sources;
-        auto sourcesFile = to / "sources.cmake";
-        if (incremental && exists(sourcesFile)) {
-            auto content = read_file(sourcesFile);
-            if (content) {
-                sources_times = read_sources(content.value());
+        Options sync_options = {
+            .wrap_headers = wrap_headers,
+            .wrap_headers_add_random = true,
+            .add_lines = add_lines,
+            .stable_lines = stable_lines,
+            .reproducible = reproducible,
+            .engine = engine,
+            .prune_includes = prune_includes
+        };
+        IncludedHeaders included(from);
+        if (forward_declare) {
+            sync_options.forward_declare = included.resolver("");
+        }
+
+        // without -i nothing is compared against the old state, but it's still saved for the next -i run,
+        // and it always tells which outputs belong to inputs that have been deleted since
+        State state, previous, new_state;
+        new_state.options_hash = options_hash(sync_options);
+        auto stateFile = to / State::FILE_NAME;
+        if (auto content = read_file(stateFile)) {
+            // nothing else is looked at, and nothing is written
+            if (incremental && !result.count("watch") && nothing_changed(from, to, content.value(), new_state.options_hash, generate_sources, pch)) {
+                return 0;
             }
+            previous = State::parse(content.value());
+        }
+        if (incremental && previous.options_hash == new_state.options_hash) {
+            state = previous;
+        }
+
+        std::optional<GenerationCache> cache;
+        if (result.count("cache-dir")) {
+            cache.emplace(result["cache-dir"].as<std::string>(), result["cache-size"].as<uint64_t>() * 1024 * 1024);
         }
 
-        sync("", from, to, {
-            wrap_headers, true, add_lines, incremental
-        }, sources_times, sources);
+        auto extractDir = to / ".headless-extract";
+        if (!exists(extractDir)) {
+            mkdirp(extractDir);
+        }
+
+        SyncContext context = {
+            .options = sync_options,
+            .state = state,
+            .cache = cache ? &*cache : nullptr,
+            .extract_dir = extractDir,
+            .copy_mode = copy_mode,
+            .io_uring = io == "uring",
+            .included = forward_declare ? &included : nullptr,
+            .map_inputs = !result.count("watch"),
+        };
+        std::vector<CodeFile> sources;
+        auto sourcesFile = to / "sources.cmake";
+        auto from_snapshot = Snapshot::scan(from);
+        auto to_snapshot = Snapshot::scan(to);
+        if (forward_declare) {
+            forget_headers_if_changed(from_snapshot, state);
+        }
+        auto results = sync(from, to, from_snapshot, to_snapshot, jobs, context);
+        merge(results, new_state, sources);
+        report(results);
+        prune_outputs(from, to, previous, results);
+        record_dirs(to, from_snapshot, new_state);
+        prune_extractions(extractDir, new_state, engine);
+        if (cache) {
+            cache->evict();
+        }
+        write_file(stateFile, new_state.serialize());
 
         if (generate_sources) {
             write_file(sourcesFile, write_sources(sources));
         }
+        if (pch) {
+            write_pch(from, to, sources);
+        }
+
+        if (result.count("watch")) {
+#ifdef __linux__
+            SyncContext watch_context = {
+                .options = sync_options,
+                .state = new_state,
+                .cache = context.cache,
+                .extract_dir = extractDir,
+                .copy_mode = copy_mode,
+                .included = context.included,
+                .map_inputs = false,
+            };
+            watch(from, to, watch_context, std::move(results), generate_sources, pch);
+#else
+            std::cerr << "headless: --watch is only supported on Linux" << std::endl;
+            return 1;
+#endif
+        }
         return 0;
     }
 
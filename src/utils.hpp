@@ -7,23 +7,284 @@
 #include <optional>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <cerrno>
+#include <utility>
+#include <random>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#elif defined(__APPLE__)
+#include <sys/clonefile.h>
+#endif
 
-std::optional<std::string> read_file(const std::string& path) {
-    std::ifstream file(path);
-    if (!file) {
+inline std::optional<std::string> read_file(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
         return std::nullopt;
     }
-    std::string content((std::istreambuf_iterator(file)), std::istreambuf_iterator<char>());
-    return { content };
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return std::nullopt;
+    }
+    // sized up front, so the content is read once into its final place
+    std::string content(static_cast<size_t>(st.st_size), '\0');
+    size_t done = 0;
+    while (done < content.size()) {
+        auto n = read(fd, content.data() + done, content.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+    content.resize(done);
+    // the file may have grown in between, or not be a regular file with a size
+    char more[4096];
+    while (true) {
+        auto n = read(fd, more, sizeof(more));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        content.append(more, n);
+    }
+    close(fd);
+    return { std::move(content) };
+}
+
+// Whole file as a read-only mapping, for inputs that are only looked at. Small files are read instead,
+// a mapping isn't worth a syscall pair for them
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept :
+    mapping(std::exchange(other.mapping, nullptr)), size(std::exchange(other.size, 0)), content(std::move(other.content)) {}
+
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        std::swap(mapping, other.mapping);
+        std::swap(size, other.size);
+        std::swap(content, other.content);
+        return *this;
+    }
+
+    ~MappedFile() {
+        if (mapping) munmap(mapping, size);
+    }
+
+    [[nodiscard]] std::string_view view() const {
+        return mapping ? std::string_view(static_cast<const char*>(mapping), size) : std::string_view(content);
+    }
+
+    static const size_t MIN_MAPPED_SIZE = 64 * 1024;
+
+    // Without `map`, always read: a mapping is only safe while nobody truncates the file
+    static std::optional<MappedFile> open(const std::string& path, bool map = true) {
+        MappedFile file;
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return std::nullopt;
+        struct stat st;
+        if (map && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && static_cast<size_t>(st.st_size) >= MIN_MAPPED_SIZE) {
+            void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED) {
+                close(fd);
+                file.mapping = mapping;
+                file.size = st.st_size;
+                return file;
+            }
+        }
+        close(fd);
+        auto content = read_file(path);
+        if (!content) return std::nullopt;
+        file.content = std::move(*content);
+        return file;
+    }
+
+    // Content that was already read some other way
+    static MappedFile of(std::string content) {
+        MappedFile file;
+        file.content = std::move(content);
+        return file;
+    }
+
+private:
+    void* mapping = nullptr;
+    size_t size = 0;
+    std::string content;
+};
+
+// Unique between threads, processes and (for shared directories) machines
+inline std::string temp_path(const std::string& path) {
+    static const auto salt = std::random_device{}();
+    static std::atomic<unsigned> counter = 0;
+    return path + ".tmp-" + std::to_string(getpid()) + "-" + std::to_string(salt) + "-" + std::to_string(counter++);
+}
+
+// Whether `path` is a file with exactly this content
+inline bool has_content(const std::string& path, std::string_view content) {
+    auto stat = std::filesystem::status(path);
+    if (std::filesystem::is_regular_file(stat) && std::filesystem::file_size(path) == content.size()) {
+        auto existing = MappedFile::open(path);
+        return existing && existing->view() == content;
+    }
+    return false;
+}
+
+// Writes through a temporary file that is renamed into place, so nobody sees a half-written file.
+// Leaves the file (and its mtime) untouched when it already has this content, returns whether it was written
+inline bool write_file(const std::string& path, std::string_view content) {
+    if (has_content(path, content)) {
+        return false;
+    }
+
+    auto tmp = temp_path(path);
+    {
+        std::ofstream file(tmp, std::ios::binary);
+        if (!file) return false;
+        file.write(content.data(), static_cast<std::streamsize>(content.size()));
+        if (!file.flush()) {
+            file.close();
+            std::filesystem::remove(tmp);
+            return false;
+        }
+    }
+    std::filesystem::rename(tmp, path);
+    return true;
+}
+
+// Copy-on-write clone, works only where the filesystem supports it
+inline bool reflink_file(const std::string& from, const std::string& to) {
+#if defined(__linux__)
+    int in = open(from.c_str(), O_RDONLY);
+    if (in < 0) return false;
+    // same permissions as `from`, as a copy would have (scripts stay executable)
+    struct stat st;
+    if (fstat(in, &st) != 0) {
+        close(in);
+        return false;
+    }
+    int out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 07777);
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+    bool cloned = ioctl(out, FICLONE, in) == 0;
+    close(in);
+    close(out);
+    if (!cloned) ::unlink(to.c_str());
+    return cloned;
+#elif defined(__APPLE__)
+    return clonefile(from.c_str(), to.c_str(), 0) == 0;
+#else
+    return false;
+#endif
+}
+
+inline bool hardlink_file(const std::string& from, const std::string& to) {
+    return link(from.c_str(), to.c_str()) == 0;
+}
+
+// Copy done by the kernel, without going through userspace buffers (and server-side on NFS/SMB), Linux only
+inline bool copy_range_file(const std::string& from, const std::string& to) {
+#if defined(__linux__)
+    int in = open(from.c_str(), O_RDONLY);
+    if (in < 0) return false;
+    struct stat st;
+    if (fstat(in, &st) != 0) {
+        close(in);
+        return false;
+    }
+    int out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 07777);
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+    bool copied = true;
+    for (off_t left = st.st_size; left > 0;) {
+        auto n = copy_file_range(in, nullptr, out, nullptr, static_cast<size_t>(left), 0);
+        // not supported between these filesystems, or the file got shorter while copying
+        if (n <= 0) {
+            copied = false;
+            break;
+        }
+        left -= n;
+    }
+    close(in);
+    close(out);
+    if (!copied) ::unlink(to.c_str());
+    return copied;
+#else
+    return false;
+#endif
 }
 
-void write_file(const std::string& path, const std::string& content) {
-    std::ofstream file(path);
-    if (file) file << content;
+// How files that are synced as they are end up in `--to`
+enum class CopyMode {
+    Auto,       // reflink, otherwise `copy_file_range`, otherwise copy
+    Reflink,
+    Hardlink,
+    Symlink,
+    Copy
+};
+
+inline std::optional<CopyMode> parse_copy_mode(std::string_view name) {
+    if (name == "auto") return CopyMode::Auto;
+    if (name == "reflink") return CopyMode::Reflink;
+    if (name == "hardlink") return CopyMode::Hardlink;
+    if (name == "symlink") return CopyMode::Symlink;
+    if (name == "copy") return CopyMode::Copy;
+    return std::nullopt;
+}
+
+// Creates `to` with the content of `from`. Reflinks and hardlinks that aren't possible
+// (other filesystem, no support) become a plain copy
+inline void place_file(const std::string& from, const std::string& to, CopyMode mode) {
+    switch (mode) {
+        case CopyMode::Auto:
+            if (reflink_file(from, to) || copy_range_file(from, to)) return;
+            break;
+        case CopyMode::Reflink:
+            if (reflink_file(from, to)) return;
+            break;
+        case CopyMode::Hardlink:
+            if (hardlink_file(from, to)) return;
+            break;
+        case CopyMode::Symlink:
+            std::filesystem::create_symlink(std::filesystem::absolute(from), to);
+            return;
+        case CopyMode::Copy:
+            break;
+    }
+    std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing);
+}
+
+inline bool same_content(const std::string& a, const std::string& b) {
+    std::error_code ec;
+    if (std::filesystem::file_size(a, ec) != std::filesystem::file_size(b, ec) || ec) {
+        return false;
+    }
+    std::ifstream fa(a, std::ios::binary), fb(b, std::ios::binary);
+    char ba[65536], bb[65536];
+    while (fa && fb) {
+        fa.read(ba, sizeof(ba));
+        fb.read(bb, sizeof(bb));
+        if (fa.gcount() != fb.gcount() || std::memcmp(ba, bb, fa.gcount()) != 0) {
+            return false;
+        }
+    }
+    return fa.eof() && fb.eof();
 }
 
-std::vector<std::pair<std::string, bool>> read_dir(const std::string& path) {
+inline std::vector<std::pair<std::string, bool>> read_dir(const std::string& path) {
     std::vector<std::pair<std::string, bool>> entries;
     for (const auto& entry : std::filesystem::directory_iterator(path)) {
         entries.emplace_back(
@@ -31,34 +292,78 @@ std::vector<std::pair<std::string, bool>> read_dir(const std::string& path) {
             entry.is_directory()
         );
     }
+    std::sort(entries.begin(), entries.end());
     return entries;
 }
 
-long get_last_modified(const std::string& path) {
-    auto ftime = std::filesystem::last_write_time(path);
-    auto sctp = std::chrono::time_point_cast<std::chrono::system_clock::duration>(
-        ftime - decltype(ftime)::clock::now() + std::chrono::system_clock::now()
-    );
-    return std::chrono::system_clock::to_time_t(sctp);
+struct FileStat {
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t inode;
+
+    bool operator==(const FileStat&) const = default;
+};
+
+inline FileStat to_file_stat(const struct stat& st) {
+#ifdef __APPLE__
+    const auto& mtime = st.st_mtimespec;
+#else
+    const auto& mtime = st.st_mtim;
+#endif
+    return FileStat{
+        static_cast<uint64_t>(st.st_size),
+        static_cast<int64_t>(mtime.tv_sec) * 1000000000 + mtime.tv_nsec,
+        static_cast<uint64_t>(st.st_ino)
+    };
+}
+
+inline std::optional<FileStat> stat_file(const std::string& path) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) {
+        return std::nullopt;
+    }
+    return to_file_stat(st);
+}
+
+// Unlike `std::filesystem::relative`, doesn't resolve symlinks, so it only depends on how paths are spelled
+inline std::string lexically_relative(const std::filesystem::path& path, const std::filesystem::path& base) {
+    auto normal_path = std::filesystem::absolute(path).lexically_normal();
+    auto normal_base = std::filesystem::absolute(base).lexically_normal();
+    return normal_path.lexically_relative(normal_base).generic_string();
 }
 
-bool exists(const std::string& path) {
+inline bool exists(const std::string& path) {
     return std::filesystem::exists(path);
 }
 
-void mkdirp(const std::string& path) {
+inline void mkdirp(const std::string& path) {
     std::filesystem::create_directories(path);
 }
 
-void unlink(const std::string& path) {
+inline void unlink(const std::string& path) {
     std::filesystem::remove(path);
 }
 
-void copy(const std::string& from, const std::string& to) {
-    std::filesystem::copy_file(from, to);
+// Same as `write_file`, but for copying: atomic, and a no-op when `to` already has the same content.
+// A symlink always has the same content, so it's only kept when it's what `mode` asks for
+inline bool copy_if_changed(const std::string& from, const std::string& to, CopyMode mode = CopyMode::Auto) {
+    if ((mode == CopyMode::Symlink) == std::filesystem::is_symlink(to) && same_content(from, to)) {
+        return false;
+    }
+    auto tmp = temp_path(to);
+    place_file(from, tmp, mode);
+    std::filesystem::rename(tmp, to);
+    return true;
 }
 
-long long millis() {
+// Same clock as file timestamps
+inline int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()
+    ).count();
+}
+
+inline long long millis() {
     return std::chrono::duration_cast<std::chrono::milliseconds>(
         std::chrono::system_clock::now().time_since_epoch()
     ).count();
@@ -66,7 +371,7 @@ long long millis() {
 
 const char separator = std::filesystem::path::preferred_separator;
 
-std::string ext(const std::string& filename) {
+inline std::string ext(const std::string& filename) {
     auto idx = filename.find_last_of('.');
     if (idx == std::string::npos) {
         return "";
@@ -74,7 +379,7 @@ std::string ext(const std::string& filename) {
     return filename.substr(idx + 1);
 }
 
-std::string filename(const std::string& filename) {
+inline std::string filename(const std::string& filename) {
     auto idx = filename.find_last_of('.');
     if (idx == std::string::npos) {
         return "";
@@ -82,7 +387,11 @@ std::string filename(const std::string& filename) {
     return filename.substr(0, idx);
 }
 
-const char* ws = " \t\n\r\f\v";
+inline bool is_whitespace(char a) {
+    return a == ' ' || a == '\t' || a == '\n' || a == '\r' || a == '\f' || a == '\v';
+}
+
+constexpr const char* ws = " \t\n\r\f\v";
 inline std::string& rtrim(std::string& s, const char* t = ws) {
     s.erase(s.find_last_not_of(t) + 1);
     return s;
@@ -98,7 +407,7 @@ inline std::string& trim(std::string& s, const char* t = ws) {
 }
 
 #include <regex>
-std::string escape(const std::string& s) {
+inline std::string escape(const std::string& s) {
     auto replaced = std::regex_replace(s, std::regex{ "\\s+" }, " ");
     return trim(replaced);
 }
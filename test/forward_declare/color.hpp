@@ -0,0 +1,5 @@
+#pragma once
+
+struct Color {
+    int r = 0, g = 0, b = 0;
+};
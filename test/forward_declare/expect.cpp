@@ -0,0 +1,13 @@
+#include "expect.hpp"
+#include "shape.hpp"
+
+void draw::Canvas::fill(const Color& color) { background = color; };
+std::string draw::Canvas::name() const {
+        return "canvas";
+    };
+double draw::area(const geo::Shape& shape) {
+    return shape.area();
+};
+geo::Shape* draw::largest(geo::Shape* a, geo::Shape* b) {
+    return a->area() > b->area() ? a : b;
+};
@@ -0,0 +1,25 @@
+#pragma once
+#include <string>
+namespace geo { class Shape; }
+namespace geo { template <typename T> class Box; }
+#include "color.hpp"
+
+namespace draw {
+
+class Canvas {
+public:
+    void add(geo::Shape* shape);
+    void store(geo::Box<int>* box);
+    void fill(const Color& color);
+    std::string name() const;
+
+private:
+    Color background;
+    geo::Shape* last = nullptr;
+};
+
+double area(const geo::Shape& shape);
+
+geo::Shape* largest(geo::Shape* a, geo::Shape* b);
+
+}
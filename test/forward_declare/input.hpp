@@ -0,0 +1,30 @@
+#pragma once
+#include <string>
+#include "shape.hpp"
+#include "color.hpp"
+
+namespace draw {
+
+class Canvas {
+public:
+    void add(geo::Shape* shape);
+    void store(geo::Box<int>* box);
+    void fill(const Color& color) { background = color; }
+    std::string name() const {
+        return "canvas";
+    }
+
+private:
+    Color background;
+    geo::Shape* last = nullptr;
+};
+
+double area(const geo::Shape& shape) {
+    return shape.area();
+}
+
+geo::Shape* largest(geo::Shape* a, geo::Shape* b) {
+    return a->area() > b->area() ? a : b;
+}
+
+}
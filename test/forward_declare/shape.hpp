@@ -0,0 +1,21 @@
+#pragma once
+#include <vector>
+
+namespace geo {
+
+enum class Kind { Circle, Square };
+
+class Shape {
+public:
+    virtual ~Shape() = default;
+    virtual double area() const = 0;
+};
+
+template <typename T>
+class Box {
+    T value;
+};
+
+double total(const std::vector<Shape*>& shapes);
+
+}
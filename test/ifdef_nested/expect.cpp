@@ -0,0 +1,30 @@
+#include "expect.hpp"
+
+#if defined(A) && defined(B)
+void nested() {
+    printf("A and B\n");
+};
+#endif
+#if defined(A) && !defined(B)
+void nestedElse() {
+    printf("A, not B\n");
+};
+#endif
+#if defined(A)
+void outer() {
+    printf("A\n");
+};
+#endif
+#if !defined(A) && (C || D)
+void elif() {
+    printf("C or D\n");
+};
+#endif
+void unconditional() {
+    printf("always\n");
+};
+#if !defined(E)
+void afterClosed() {
+    printf("not E\n");
+};
+#endif
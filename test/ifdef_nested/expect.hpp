@@ -0,0 +1,18 @@
+#include <stdio.h>
+
+#if defined(A)
+#ifdef B
+void nested();
+#else
+void nestedElse();
+#endif
+void outer();
+#elif C || D
+void elif();
+#endif
+
+void unconditional();
+
+#ifndef E
+void afterClosed();
+#endif
@@ -0,0 +1,30 @@
+#include <stdio.h>
+
+#if defined(A)
+#ifdef B
+void nested() {
+    printf("A and B\n");
+}
+#else
+void nestedElse() {
+    printf("A, not B\n");
+}
+#endif
+void outer() {
+    printf("A\n");
+}
+#elif C || D
+void elif() {
+    printf("C or D\n");
+}
+#endif
+
+void unconditional() {
+    printf("always\n");
+}
+
+#ifndef E
+void afterClosed() {
+    printf("not E\n");
+}
+#endif
@@ -0,0 +1,16 @@
+#include "expect.hpp"
+
+
+#line 7 "input.hpp"
+int shapes::Square::area() const {
+#line 8 "input.hpp"
+            return side * side;
+#line 9 "input.hpp"
+        };
+
+#line 16 "input.hpp"
+int shapes::half(int x) {
+#line 17 "input.hpp"
+        return x / 2;
+#line 18 "input.hpp"
+    };
@@ -0,0 +1,22 @@
+#line 1 "input.hpp"
+#pragma once
+#line 3 "input.hpp"
+namespace shapes {
+#line 4 "input.hpp"
+    struct Square {
+#line 5 "input.hpp"
+        int side = 0;
+#line 7 "input.hpp"
+        int area() const;
+#line 10 "input.hpp"
+    };
+#line 12 "input.hpp"
+    inline int twice(int x) {
+#line 13 "input.hpp"
+        return x * 2;
+#line 14 "input.hpp"
+    }
+#line 16 "input.hpp"
+    int half(int x);
+#line 19 "input.hpp"
+}
\ No newline at end of file
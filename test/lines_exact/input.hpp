@@ -0,0 +1,19 @@
+#pragma once
+
+namespace shapes {
+    struct Square {
+        int side = 0;
+
+        int area() const {
+            return side * side;
+        }
+    };
+
+    inline int twice(int x) {
+        return x * 2;
+    }
+
+    int half(int x) {
+        return x / 2;
+    }
+}
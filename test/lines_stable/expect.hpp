@@ -0,0 +1,21 @@
+#line 1 "input.hpp"
+#include <stdio.h>
+
+#line 3 "input.hpp"
+class Class {
+#line 4 "input.hpp"
+    static int a;
+#line 8 "expect.hpp"
+    static int c;
+
+    void method();
+
+    void method2(
+      const int& a = 1,
+      const int& b = 2
+    );
+
+    const int method3() const;
+};
+
+extern int b;
\ No newline at end of file
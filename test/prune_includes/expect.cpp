@@ -0,0 +1,10 @@
+#include "expect.hpp"
+#include <regex>
+#include <iostream>
+
+bool Matcher::matches(const std::string& s) const {
+        return std::regex_match(s, std::regex(pattern));
+    };
+void print(const std::string& s) {
+    std::cout << s << std::endl;
+};
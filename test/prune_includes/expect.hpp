@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+#include <sstream>
+
+struct Matcher {
+    std::string pattern;
+
+    bool matches(const std::string& s) const;
+};
+
+inline std::string twice(const std::string& s) {
+    std::stringstream out;
+    out << s << s;
+    return out.str();
+}
+
+void print(const std::string& s);
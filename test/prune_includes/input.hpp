@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+#include <regex>
+#include <sstream>
+#include <iostream>
+
+struct Matcher {
+    std::string pattern;
+
+    bool matches(const std::string& s) const {
+        return std::regex_match(s, std::regex(pattern));
+    }
+};
+
+inline std::string twice(const std::string& s) {
+    std::stringstream out;
+    out << s << s;
+    return out.str();
+}
+
+void print(const std::string& s) {
+    std::cout << s << std::endl;
+}
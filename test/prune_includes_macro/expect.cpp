@@ -0,0 +1,5 @@
+#include "expect.hpp"
+
+void print(double value) {
+    std::cout << value << std::endl;
+};
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <iostream>
+
+constexpr auto LIMIT = UINT32_MAX;
+
+inline double turns(double radians) {
+    return radians / (2 * M_PI);
+}
+
+void print(double value);
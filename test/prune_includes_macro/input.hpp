@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <iostream>
+
+constexpr auto LIMIT = UINT32_MAX;
+
+inline double turns(double radians) {
+    return radians / (2 * M_PI);
+}
+
+void print(double value) {
+    std::cout << value << std::endl;
+}
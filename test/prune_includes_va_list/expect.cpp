@@ -0,0 +1,5 @@
+#include "expect.hpp"
+
+void print(const std::string& s) {
+    std::printf("%s\n", s.c_str());
+};
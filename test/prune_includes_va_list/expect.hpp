@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+void report(const char* format, va_list args);
+
+inline std::string twice(const std::string& s) {
+    return s + s;
+}
+
+void print(const std::string& s);
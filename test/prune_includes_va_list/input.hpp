@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+void report(const char* format, va_list args);
+
+inline std::string twice(const std::string& s) {
+    return s + s;
+}
+
+void print(const std::string& s) {
+    std::printf("%s\n", s.c_str());
+}
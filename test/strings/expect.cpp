@@ -0,0 +1,14 @@
+#include "expect.hpp"
+
+void url() {
+    printf("http://example.com/*not a comment*/\n");
+};
+#if defined(DEBUG)
+void pattern() {
+    printf(R"(// #endif
+)");
+};
+#endif
+int separated() {
+    return 1'000 + '"' + '/';
+};
@@ -0,0 +1,9 @@
+#include <stdio.h>
+
+void url();
+
+#ifdef DEBUG
+void pattern();
+#endif
+
+int separated();
@@ -0,0 +1,16 @@
+#include <stdio.h>
+
+void url() {
+    printf("http://example.com/*not a comment*/\n");
+}
+
+#ifdef DEBUG
+void pattern() {
+    printf(R"(// #endif
+)");
+}
+#endif
+
+int separated() {
+    return 1'000 + '"' + '/';
+}
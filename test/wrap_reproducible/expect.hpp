@@ -0,0 +1,12 @@
+#ifndef EXPECT_HPP_b91a3c87
+#define EXPECT_HPP_b91a3c87
+
+#include <stdio.h>
+
+class Class {
+    void method();
+    void method2(const int& a = 1, const int& b = 2);
+    const int method3() const;
+};
+
+#endif
\ No newline at end of file